@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "affinity.h"
+#include "topology.h"
+
+#define AFFINITY_MAX_CPUS 1024
+
+typedef struct {
+    CpuInfo info;
+    int group;          // ordinal of its (package, L3) pair
+    int group_rank;     // rank of that L3 inside its package
+    int core_rank;      // rank of its core inside the group
+} Slot;
+
+AffinityPolicy affinity_policy = AFFINITY_NONE;
+static int order[AFFINITY_MAX_CPUS];
+static int order_len;
+static int topo_ncpus, topo_cores, topo_groups, topo_packages;
+
+static int cmp3(int a0, int b0, int a1, int b1, int a2, int b2) {
+    if (a0 != b0) return a0 - b0;
+    if (a1 != b1) return a1 - b1;
+    return a2 - b2;
+}
+
+static int by_compact(const void* a, const void* b) {
+    const Slot *x = a, *y = b;
+    return cmp3(x->group, y->group, x->core_rank, y->core_rank, x->info.smt, y->info.smt);
+}
+
+// alternates packages first, then the L3 groups inside them
+static int by_scatter(const void* a, const void* b) {
+    const Slot *x = a, *y = b;
+    int c = cmp3(x->info.smt, y->info.smt, x->core_rank, y->core_rank, x->group_rank, y->group_rank);
+    return c ? c : x->info.package - y->info.package;
+}
+
+static int by_smt_avoid(const void* a, const void* b) {
+    const Slot *x = a, *y = b;
+    return cmp3(x->info.smt, y->info.smt, x->group, y->group, x->core_rank, y->core_rank);
+}
+
+void select_affinity(void) {
+    const char* name = getenv("CNN_AFFINITY");
+    if (name && strcmp(name, "compact") == 0)
+        affinity_policy = AFFINITY_COMPACT;
+    else if (name && strcmp(name, "scatter") == 0)
+        affinity_policy = AFFINITY_SCATTER;
+    else if (name && strcmp(name, "core") == 0)
+        affinity_policy = AFFINITY_CORE;
+    else if (name && strcmp(name, "smt-avoid") == 0)
+        affinity_policy = AFFINITY_SMT_AVOID;
+    else
+        affinity_policy = AFFINITY_NONE;
+
+    static CpuInfo cpus[AFFINITY_MAX_CPUS];
+    static Slot slots[AFFINITY_MAX_CPUS];
+    int n = topo_cpus(cpus, AFFINITY_MAX_CPUS);
+    topo_ncpus = n;
+    int group_pkg[AFFINITY_MAX_CPUS], group_l3[AFFINITY_MAX_CPUS];
+    topo_groups = topo_cores = topo_packages = 0;
+
+    for (int i = 0; i < n; i++) {
+        slots[i].info = cpus[i];
+        int g = 0;
+        while (g < topo_groups && !(group_pkg[g] == cpus[i].package && group_l3[g] == cpus[i].l3)) g++;
+        if (g == topo_groups) {
+            group_pkg[g] = cpus[i].package;
+            group_l3[g] = cpus[i].l3;
+            topo_groups++;
+        }
+        slots[i].group = g;
+        slots[i].group_rank = 0;
+        for (int k = 0; k < g; k++) slots[i].group_rank += (group_pkg[k] == cpus[i].package);
+        topo_cores += (cpus[i].smt == 0);
+        if (cpus[i].package + 1 > topo_packages) topo_packages = cpus[i].package + 1;
+    }
+    for (int i = 0; i < n; i++) {
+        slots[i].core_rank = 0;
+        for (int k = 0; k < n; k++)
+            slots[i].core_rank += (slots[k].group == slots[i].group && slots[k].info.smt == 0 &&
+                                   slots[k].info.core < slots[i].info.core);
+    }
+
+    int len = 0;
+    if (affinity_policy == AFFINITY_CORE) {
+        for (int i = 0; i < n; i++)
+            if (slots[i].info.smt == 0) slots[len++] = slots[i];
+    } else {
+        len = n;
+    }
+    if (affinity_policy == AFFINITY_SCATTER)
+        qsort(slots, len, sizeof(Slot), by_scatter);
+    else if (affinity_policy == AFFINITY_SMT_AVOID)
+        qsort(slots, len, sizeof(Slot), by_smt_avoid);
+    else
+        qsort(slots, len, sizeof(Slot), by_compact);
+
+    for (int i = 0; i < len; i++) order[i] = slots[i].info.cpu;
+    order_len = len;
+}
+
+const char* affinity_policy_name(AffinityPolicy policy) {
+    switch (policy) {
+    case AFFINITY_NONE: return "none";
+    case AFFINITY_COMPACT: return "compact";
+    case AFFINITY_SCATTER: return "scatter";
+    case AFFINITY_CORE: return "core";
+    case AFFINITY_SMT_AVOID: return "smt-avoid";
+    }
+    return "unknown";
+}
+
+// -1 when no policy is set or none of the policy's CPUs is in allowed
+int affinity_cpu_in(int slot, const cpu_set_t* allowed) {
+    if (affinity_policy == AFFINITY_NONE || order_len == 0) return -1;
+    int usable = 0;
+    for (int i = 0; i < order_len; i++) usable += CPU_ISSET(order[i], allowed) != 0;
+    if (usable == 0) return -1;
+    int k = slot % usable;
+    for (int i = 0; i < order_len; i++)
+        if (CPU_ISSET(order[i], allowed) && k-- == 0) return order[i];
+    return -1;
+}
+
+// -1 when no policy is set or none of the policy's CPUs is allowed for the calling process
+int affinity_cpu(int slot) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+    return affinity_cpu_in(slot, &allowed);
+}
+
+void affinity_pin_self(int slot) {
+    int cpu = affinity_cpu(slot);
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+void affinity_attr(pthread_attr_t* attr, int slot) {
+    int cpu = affinity_cpu(slot);
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+static void print_policy(void) {
+    printf("Affinity Policy    : %s (%d cpus, %d cores, %d L3 group(s), %d package(s))\n",
+           affinity_policy_name(affinity_policy), topo_ncpus, topo_cores, topo_groups, topo_packages);
+}
+
+void print_affinity(int processes, int threads) {
+    print_policy();
+    if (affinity_policy != AFFINITY_NONE) {
+        printf("  producer         : cpu %d\n", affinity_cpu(0));
+        for (int p = 0; p < processes; p++) {
+            printf("  process %-8d :", p);
+            for (int t = 0; t < threads; t++) printf(" %d", affinity_cpu(1 + p * threads + t));
+            printf("\n");
+        }
+    }
+    fflush(stdout);
+}
+
+// Worker p runs bound to nodes[p % num_nodes] (topo_bind_node() before its threads start), so
+// its slots resolve against that node's CPUs within the parent's mask.
+void print_affinity_nodes(int processes, int threads, const NumaNode nodes[], int num_nodes) {
+    print_policy();
+    cpu_set_t allowed;
+    if (affinity_policy != AFFINITY_NONE && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        printf("  producer         : cpu %d\n", affinity_cpu(0));
+        for (int p = 0; p < processes; p++) {
+            const NumaNode* node = &nodes[p % num_nodes];
+            cpu_set_t set;
+            CPU_AND(&set, &allowed, &node->cpus);
+            printf("  process %-8d : node %d,", p, node->id);
+            for (int t = 0; t < threads; t++) printf(" %d", affinity_cpu_in(1 + p * threads + t, &set));
+            printf("\n");
+        }
+    }
+    fflush(stdout);
+}
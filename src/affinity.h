@@ -0,0 +1,35 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include "topology.h"
+
+// Pinning of the producer (slot 0) and consumer threads (slot 1 + process * threads + thread)
+// to CPUs, in an order derived from the core / SMT / L3 topology:
+//   compact   fill every hardware thread of a core, then the next core of the same L3
+//   scatter   round-robin over the L3 groups, physical cores before SMT siblings
+//   core      one thread per physical core (SMT siblings unused, slots wrap around)
+//   smt-avoid every physical core first, SMT siblings only once the cores run out
+// Slots index the order after dropping CPUs the calling process may not use, so the policy
+// composes with CNN_NUMA's per-node binding.
+typedef enum {
+    AFFINITY_NONE,
+    AFFINITY_COMPACT,
+    AFFINITY_SCATTER,
+    AFFINITY_CORE,
+    AFFINITY_SMT_AVOID
+} AffinityPolicy;
+
+extern AffinityPolicy affinity_policy;
+
+void select_affinity(void);
+const char* affinity_policy_name(AffinityPolicy policy);
+int affinity_cpu(int slot);
+int affinity_cpu_in(int slot, const cpu_set_t* allowed);
+void affinity_pin_self(int slot);
+void affinity_attr(pthread_attr_t* attr, int slot);
+void print_affinity(int processes, int threads);
+void print_affinity_nodes(int processes, int threads, const NumaNode nodes[], int num_nodes);
+
+#endif // AFFINITY_H
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cnn_common.h"
+#include "model_file.h"
+#include "huge_pages.h"
+#include "topology.h"
+#include "layer_timer.h"
+#include "perf_counters.h"
+#include "trace.h"
+
+ConvEngine conv_engine = CONV_GEMM;
+int keep_intermediates = 0;
+int fc_batch_size = 1;
+int fc_threads = 1;
+FcDotFn fc_dot = fc_dot_scalar;
+const char* fc_dot_name = "scalar";
+int init_threads = 1;
+Placement placement = PLACE_FIRST_TOUCH;
+static _Atomic long* fc1_sweeps;
+static FcWeights fc_summary[2];   // copies of the fc1/fc2 descriptors for the final report
+static const char* model_source = "built in memory";
+static double init_msec;
+
+static void build_weights(CNNModel* model);
+
+void select_conv_engine(void) {
+    const char* name = getenv("CNN_CONV");
+    if (name && strcmp(name, "reference") == 0)
+        conv_engine = CONV_REFERENCE;
+    else if (name && strcmp(name, "direct") == 0)
+        conv_engine = CONV_DIRECT;
+    else if (name && strcmp(name, "gemm") == 0)
+        conv_engine = CONV_GEMM;
+    else if (name && strcmp(name, "winograd") == 0)
+        conv_engine = CONV_WINOGRAD;
+    else if (name && strcmp(name, "avx2") == 0 && cpu_has_avx2())
+        conv_engine = CONV_AVX2;
+    else if (name && strcmp(name, "avx512") == 0 && cpu_has_avx512())
+        conv_engine = CONV_AVX512;
+    else
+        conv_engine = best_simd_engine();
+
+    const char* keep = getenv("CNN_KEEP_INTERMEDIATES");
+    keep_intermediates = (keep && atoi(keep) != 0);
+
+    const char* verify = getenv("CNN_VERIFY");
+    if (verify && atoi(verify) != 0 && conv_engine != CONV_REFERENCE)
+        printf("Conv Engine Check  : %s vs reference, max abs err = %g\n",
+               conv_engine_name(conv_engine), check_conv_engine(conv_engine));
+}
+
+const char* conv_engine_name(ConvEngine engine) {
+    switch (engine) {
+    case CONV_REFERENCE: return "reference";
+    case CONV_DIRECT: return "direct";
+    case CONV_GEMM: return "gemm";
+    case CONV_AVX2: return "avx2";
+    case CONV_AVX512: return "avx512";
+    case CONV_WINOGRAD: return "winograd";
+    }
+    return "unknown";
+}
+
+void select_fc_batch(void) {
+    const char* batch = getenv("CNN_BATCH");
+    fc_batch_size = batch ? atoi(batch) : 1;
+    if (fc_batch_size < 1) fc_batch_size = 1;
+    if (fc_batch_size > FC_MAX_BATCH) fc_batch_size = FC_MAX_BATCH;
+
+    const char* threads = getenv("CNN_FC_THREADS");
+    fc_threads = threads ? atoi(threads) : 1;
+    if (fc_threads < 1) fc_threads = 1;
+
+    const char* init = getenv("CNN_INIT_THREADS");
+    init_threads = init ? atoi(init) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (init_threads < 1) init_threads = 1;
+
+    const char* place = getenv("CNN_PLACEMENT");
+    placement = (place && strcmp(place, "interleave") == 0) ? PLACE_INTERLEAVE : PLACE_FIRST_TOUCH;
+
+    const char* kernel = getenv("CNN_FC");
+    if (kernel && strcmp(kernel, "scalar") == 0)
+        fc_dot = fc_dot_scalar;
+    else if (kernel && strcmp(kernel, "avx2") == 0 && cpu_has_avx2())
+        fc_dot = fc_dot_avx2;
+    else if (kernel && strcmp(kernel, "avx512") == 0 && cpu_has_avx512())
+        fc_dot = fc_dot_avx512;
+    else
+        fc_dot = best_fc_dot();
+    fc_dot_name = (fc_dot == fc_dot_avx512) ? "avx512" : (fc_dot == fc_dot_avx2) ? "avx2" : "scalar";
+
+    fc1_sweeps = mmap(NULL, sizeof(_Atomic long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    atomic_store(fc1_sweeps, 0);
+}
+
+void print_fc1_traffic(int tasks_done) {
+    double mb = fc_weights_bytes(&fc_summary[0]) / (1024.0 * 1024.0);
+    long sweeps = atomic_load(fc1_sweeps);
+    printf("Model Source       : %s\n", model_source);
+    printf("Model Init Time    : %.2f ms (%d thread(s), %s)\n", init_msec, init_threads, placement_name(placement));
+    for (int l = 0; l < 2; l++) {
+        const FcWeights* w = &fc_summary[l];
+        printf("FC%d Weight Format  : %s (%.4f%% dense, %.2f MB)\n", l + 1, fc_format_name(w->format),
+               100.0 * w->nnz / ((double)w->rows * w->cols), fc_weights_bytes(w) / (1024.0 * 1024.0));
+    }
+    printf("FC Dense Kernel    : %s, %d thread(s)\n", fc_dot_name, fc_threads);
+    printf("FC1 Batch Size     : %d\n", fc_batch_size);
+    printf("FC1 Weight Traffic : %.1f MB (saved %.1f MB vs. one pass per input)\n",
+           sweeps * mb, (tasks_done - sweeps) * mb);
+    print_huge_pages();
+}
+
+const char* placement_name(Placement p) {
+    return (p == PLACE_INTERLEAVE) ? "interleave" : "first-touch";
+}
+
+// Builds the synthetic model, or maps the one in CNN_MODEL (written by model_convert).
+void initialize_weights(CNNModel* model) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const char* path = getenv("CNN_MODEL");
+    if (path) {
+        load_model_file(model, path);
+        model_source = path;
+    } else {
+        build_weights(model);
+    }
+    fc_summary[0] = model->fc1.weights;
+    fc_summary[1] = model->fc2.weights;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    init_msec = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+// A read-only copy of the whole model in a shared mapping bound to one NUMA node, for workers
+// pinned to that node (see CNN_NUMA in mpmt_mutex).
+CNNModel* replicate_model(const CNNModel* model, int node) {
+    CNNModel* r = huge_map(sizeof(CNNModel), 1, REGION_MODEL);
+    topo_bind_memory(r, sizeof(CNNModel), node);
+    memcpy(r, model, sizeof(CNNModel));
+    fc_weights_replicate(&r->fc1.weights, &model->fc1.weights, node);
+    fc_weights_replicate(&r->fc2.weights, &model->fc2.weights, node);
+    return r;
+}
+
+// The identity rows are written by the thread team so first touch (or the interleave policy)
+// decides where each page of the matrix lives.
+static void fill_identity_rows(FcWeights* w, int r0, int r1, void* arg) {
+    for (int i = r0; i < r1; i++) {
+        float* row = w->dense + (size_t)i * w->cols;
+        memset(row, 0, sizeof(float) * w->cols);
+        if (i < w->cols) row[i] = 1.0f;
+    }
+}
+
+static void build_weights(CNNModel* model) {
+    int kernel[3][3] = {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}};
+    for (int d = 0; d < CONV_DEPTH; d++) {
+        model->conv.biases[d] = 1.0f;
+        for (int c = 0; c < CHANNELS; c++)
+            for (int i = 0; i < KERNEL_SIZE; i++)
+                for (int j = 0; j < KERNEL_SIZE; j++)
+                    model->conv.weights[d][c][i][j] = kernel[i][j];
+    }
+
+    fc_weights_alloc(&model->fc1.weights, FC1_OUT, FLAT_SIZE);
+    for (int i = 0; i < FC1_OUT; i++) model->fc1.biases[i] = 1.0f;
+    fc_parallel_rows(&model->fc1.weights, fill_identity_rows, NULL);
+
+    fc_weights_alloc(&model->fc2.weights, FC2_OUT, FC1_OUT);
+    for (int i = 0; i < FC2_OUT; i++) model->fc2.biases[i] = 1.0f;
+    fc_parallel_rows(&model->fc2.weights, fill_identity_rows, NULL);
+
+    prepare_conv_layer(&model->conv);
+    prepare_fc_layers(model);
+}
+
+// Converts FC matrices sparser than CNN_SPARSE (default 0.1, 0 keeps everything dense) to the
+// CNN_SPARSE_FORMAT layout (csr, bsr or auto).
+void prepare_fc_layers(CNNModel* model) {
+    const char* density = getenv("CNN_SPARSE");
+    float max_density = density ? atof(density) : 0.1f;
+    const char* format = getenv("CNN_SPARSE_FORMAT");
+
+    fc_sparsify(&model->fc1.weights, max_density, format);
+    fc_sparsify(&model->fc2.weights, max_density, format);
+}
+
+void prepare_conv_layer(ConvLayer* conv) {
+    for (int d = 0; d < CONV_DEPTH; d++)
+        for (int c = 0; c < CHANNELS; c++)
+            for (int ki = 0; ki < KERNEL_SIZE; ki++)
+                for (int kj = 0; kj < KERNEL_SIZE; kj++)
+                    conv->taps[(c * KERNEL_SIZE + ki) * KERNEL_SIZE + kj][d] = conv->weights[d][c][ki][kj];
+    pack_gemm_weights(conv);
+    prepare_winograd(conv);
+}
+
+void initialize_input(Task* t, int id) {
+    long long start = trace_begin();
+    float center = 9.0f * (id + 1);
+    t->input_id = id;
+    for (int c = 0; c < CHANNELS; c++)
+        for (int i = 0; i < INPUT_SIZE; i++)
+            for (int j = 0; j < INPUT_SIZE; j++)
+                t->input[i][j][c] = (i == 1 && j == 1) ? center : 1.0f;
+    trace_end(TRACE_INPUT, start, id);
+}
+
+static void* scratch_map(size_t size) {
+    return huge_map(size, 0, REGION_SCRATCH);
+}
+
+static Scratch* scratch_alloc(int intermediates) {
+    Scratch* s = scratch_map(sizeof(Scratch));
+    s->conv_out = s->relu_out = NULL;
+    s->pool_out = NULL;
+    s->batch_capacity = fc_batch_size;
+    s->flat = scratch_map(sizeof(float) * FLAT_SIZE * s->batch_capacity);
+    s->fc1_out = scratch_map(sizeof(float) * FC1_OUT * s->batch_capacity);
+    if (intermediates) {
+        s->conv_out = scratch_map(sizeof(float) * CONV_OUT * CONV_OUT * CONV_DEPTH);
+        s->relu_out = scratch_map(sizeof(float) * CONV_OUT * CONV_OUT * CONV_DEPTH);
+        s->pool_out = scratch_map(sizeof(float) * POOL_OUT * POOL_OUT * CONV_DEPTH);
+    }
+    return s;
+}
+
+Scratch* scratch_create(void) {
+    return scratch_alloc(conv_engine == CONV_REFERENCE || keep_intermediates);
+}
+
+void scratch_destroy(Scratch* s) {
+    huge_unmap(s->conv_out, sizeof(float) * CONV_OUT * CONV_OUT * CONV_DEPTH);
+    huge_unmap(s->relu_out, sizeof(float) * CONV_OUT * CONV_OUT * CONV_DEPTH);
+    huge_unmap(s->pool_out, sizeof(float) * POOL_OUT * POOL_OUT * CONV_DEPTH);
+    huge_unmap(s->flat, sizeof(float) * FLAT_SIZE * s->batch_capacity);
+    huge_unmap(s->fc1_out, sizeof(float) * FC1_OUT * s->batch_capacity);
+    huge_unmap(s, sizeof(Scratch));
+}
+
+void conv_reference(const ConvLayer* conv, const Task* t, Scratch* s, float flat[FLAT_SIZE]) {
+    LAYER_TIMER_BEGIN(CONV);
+    for (int d = 0; d < CONV_DEPTH; d++)
+        for (int i = 0; i < CONV_OUT; i++)
+            for (int j = 0; j < CONV_OUT; j++) {
+                float sum = conv->biases[d];
+                for (int c = 0; c < CHANNELS; c++)
+                    for (int ki = 0; ki < KERNEL_SIZE; ki++)
+                        for (int kj = 0; kj < KERNEL_SIZE; kj++)
+                            sum += conv->weights[d][c][ki][kj] * t->input[i + ki][j + kj][c];
+                s->conv_out[i][j][d] = sum;
+                s->relu_out[i][j][d] = (sum > 0) ? sum : 0;
+            }
+    LAYER_TIMER_END(CONV);
+    LAYER_TIMER_BEGIN(POOL);
+    for (int d = 0; d < CONV_DEPTH; d++)
+        for (int x = 0; x < CONV_OUT; x += 2)
+            for (int y = 0; y < CONV_OUT; y += 2) {
+                float maxval = s->relu_out[x][y][d];
+                for (int dx = 0; dx < 2; dx++)
+                    for (int dy = 0; dy < 2; dy++)
+                        if (s->relu_out[x + dx][y + dy][d] > maxval)
+                            maxval = s->relu_out[x + dx][y + dy][d];
+                s->pool_out[x/2][y/2][d] = maxval;
+            }
+    LAYER_TIMER_END(POOL);
+    LAYER_TIMER_BEGIN(FLATTEN);
+    int idx = 0;
+    for (int d = 0; d < CONV_DEPTH; d++)
+        for (int x = 0; x < POOL_OUT; x++)
+            for (int y = 0; y < POOL_OUT; y++)
+                flat[idx++] = s->pool_out[x][y][d];
+    LAYER_TIMER_END(FLATTEN);
+}
+
+// Accumulates in the same (bias, c, ki, kj) order as conv_reference so the results match bit for bit.
+void conv_tile_direct(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                      int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]) {
+    for (int i = 0; i < TILE_H; i++)
+        for (int j = 0; j < w; j++) {
+            float* out = tile[i][j];
+            for (int d = 0; d < CONV_DEPTH; d++)
+                out[d] = conv->biases[d];
+            for (int c = 0; c < CHANNELS; c++)
+                for (int ki = 0; ki < KERNEL_SIZE; ki++)
+                    for (int kj = 0; kj < KERNEL_SIZE; kj++) {
+                        const float* tap = conv->taps[(c * KERNEL_SIZE + ki) * KERNEL_SIZE + kj];
+                        float x = input[i0 + i + ki][j0 + j + kj][c];
+                        for (int d = 0; d < CONV_DEPTH; d++)
+                            out[d] += tap[d] * x;
+                    }
+        }
+}
+
+static ConvTileFn conv_tile_fn(ConvEngine engine) {
+    switch (engine) {
+    case CONV_GEMM: return conv_tile_gemm;
+    case CONV_AVX2: return conv_tile_avx2;
+    case CONV_AVX512: return conv_tile_avx512;
+    case CONV_WINOGRAD: return conv_tile_winograd;
+    default: return conv_tile_direct;
+    }
+}
+
+// Pooled values are staged per row in [y][d] order next to the tile and transposed into the
+// channel-major flat layout once the row is complete, so flat is written in contiguous runs of
+// POOL_OUT floats instead of one scattered store per value.
+void conv_relu_pool_fused(ConvEngine engine, const ConvLayer* conv, const Task* t, Scratch* s, float flat[FLAT_SIZE]) {
+    ConvTileFn conv_tile = conv_tile_fn(engine);
+    float (*tile)[TILE_W][CONV_DEPTH] = s->tile;
+    float (*row)[CONV_DEPTH] = s->pool_row;
+
+    for (int i0 = 0; i0 < CONV_OUT; i0 += TILE_H) {
+        int x = i0 / 2;
+        for (int j0 = 0; j0 < CONV_OUT; j0 += TILE_W) {
+            int w = (CONV_OUT - j0 < TILE_W) ? CONV_OUT - j0 : TILE_W;
+            LAYER_TIMER_BEGIN(CONV);
+            conv_tile(conv, t->input, i0, j0, w, tile);
+            if (s->conv_out)
+                for (int i = 0; i < TILE_H; i++)
+                    memcpy(s->conv_out[i0 + i][j0], tile[i], sizeof(float) * w * CONV_DEPTH);
+            LAYER_TIMER_END(CONV);
+
+            if (s->relu_out) {
+                LAYER_TIMER_BEGIN(RELU);
+                for (int i = 0; i < TILE_H; i++)
+                    for (int j = 0; j < w; j++)
+                        for (int d = 0; d < CONV_DEPTH; d++)
+                            s->relu_out[i0 + i][j0 + j][d] = (tile[i][j][d] > 0) ? tile[i][j][d] : 0;
+                LAYER_TIMER_END(RELU);
+            }
+
+            LAYER_TIMER_BEGIN(POOL);
+            // max(relu(a), relu(b), ...) == relu(max(a, b, ...)), so ReLU is applied once per pooled value
+            for (int q = 0; q < w / 2; q++) {
+                int y = j0 / 2 + q;
+                for (int d = 0; d < CONV_DEPTH; d++) {
+                    float maxval = tile[0][2 * q][d];
+                    if (tile[0][2 * q + 1][d] > maxval) maxval = tile[0][2 * q + 1][d];
+                    if (tile[1][2 * q][d] > maxval) maxval = tile[1][2 * q][d];
+                    if (tile[1][2 * q + 1][d] > maxval) maxval = tile[1][2 * q + 1][d];
+                    row[y][d] = (maxval > 0) ? maxval : 0;
+                }
+            }
+            LAYER_TIMER_END(POOL);
+        }
+
+        if (s->pool_out)
+            memcpy(s->pool_out[x], row, sizeof(s->pool_row));
+        LAYER_TIMER_BEGIN(FLATTEN);
+        for (int d = 0; d < CONV_DEPTH; d++) {
+            float* dst = flat + (d * POOL_OUT + x) * POOL_OUT;
+            for (int y = 0; y < POOL_OUT; y++)
+                dst[y] = row[y][d];
+        }
+        LAYER_TIMER_END(FLATTEN);
+    }
+}
+
+static float check_value(unsigned* state) {
+    *state = *state * 1103515245u + 12345u;
+    return ((*state >> 8) & 0xffff) / 32768.0f - 1.0f;
+}
+
+// Runs engine and conv_reference on random weights and a random input and returns the largest
+// absolute difference over the full conv output.
+float check_conv_engine(ConvEngine engine) {
+    unsigned state = 1;
+    ConvLayer* conv = malloc(sizeof(ConvLayer));
+    Task* t = malloc(sizeof(Task));
+    for (int d = 0; d < CONV_DEPTH; d++) {
+        conv->biases[d] = check_value(&state);
+        for (int c = 0; c < CHANNELS; c++)
+            for (int ki = 0; ki < KERNEL_SIZE; ki++)
+                for (int kj = 0; kj < KERNEL_SIZE; kj++)
+                    conv->weights[d][c][ki][kj] = check_value(&state);
+    }
+    prepare_conv_layer(conv);
+    for (int i = 0; i < INPUT_SIZE; i++)
+        for (int j = 0; j < INPUT_SIZE; j++)
+            for (int c = 0; c < CHANNELS; c++)
+                t->input[i][j][c] = check_value(&state);
+
+    Scratch* ref = scratch_alloc(1);
+    Scratch* out = scratch_alloc(1);
+    conv_reference(conv, t, ref, ref->flat[0]);
+    conv_relu_pool_fused(engine, conv, t, out, out->flat[0]);
+
+    float max_err = 0;
+    for (int i = 0; i < CONV_OUT; i++)
+        for (int j = 0; j < CONV_OUT; j++)
+            for (int d = 0; d < CONV_DEPTH; d++) {
+                float err = fabsf(out->conv_out[i][j][d] - ref->conv_out[i][j][d]);
+                if (err > max_err) max_err = err;
+            }
+    for (int k = 0; k < FLAT_SIZE; k++) {
+        float err = fabsf(out->flat[0][k] - ref->flat[0][k]);
+        if (err > max_err) max_err = err;
+    }
+
+    scratch_destroy(ref);
+    scratch_destroy(out);
+    free(t);
+    free(conv);
+    return max_err;
+}
+
+void conv_relu_pool_fc_batch(const CNNModel* model, Task** tasks, int n, Scratch* s) {
+    PerfSnapshot perf;
+    perf_start(&perf);
+    for (int b = 0; b < n; b++) {
+        long long start = trace_begin();
+        if (conv_engine == CONV_REFERENCE)
+            conv_reference(&model->conv, tasks[b], s, s->flat[b]);
+        else
+            conv_relu_pool_fused(conv_engine, &model->conv, tasks[b], s, s->flat[b]);
+        trace_end(TRACE_CONV, start, tasks[b]->input_id);
+    }
+
+    const float* flat[FC_MAX_BATCH];
+    float* fc1_out[FC_MAX_BATCH];
+    float* fc2_out[FC_MAX_BATCH];
+    for (int b = 0; b < n; b++) {
+        flat[b] = s->flat[b];
+        fc1_out[b] = s->fc1_out[b];
+        fc2_out[b] = tasks[b]->fc2_out;
+    }
+    perf_stage(PERF_STAGE_CONV, &perf, n);
+
+    long long start = trace_begin();
+    LAYER_TIMER_BEGIN(FC1);
+    fc_forward_batch(&model->fc1.weights, model->fc1.biases, flat, fc1_out, n, PERF_STAGE_FC1);
+    LAYER_TIMER_END(FC1);
+    perf_stage(PERF_STAGE_FC1, &perf, n);
+    trace_end(TRACE_FC1, start, n);
+    start = trace_begin();
+    atomic_fetch_add(fc1_sweeps, 1);
+    LAYER_TIMER_BEGIN(FC2);
+    fc_forward_batch(&model->fc2.weights, model->fc2.biases, (const float* const*)fc1_out, fc2_out, n,
+                     PERF_STAGE_FC2);
+    LAYER_TIMER_END(FC2);
+    perf_stage(PERF_STAGE_FC2, &perf, n);
+    trace_end(TRACE_FC2, start, n);
+}
+
+void conv_relu_pool_fc(const CNNModel* model, Task* t, Scratch* s) {
+    conv_relu_pool_fc_batch(model, &t, 1, s);
+}
@@ -0,0 +1,177 @@
+#ifndef CNN_COMMON_H
+#define CNN_COMMON_H
+
+#include <stddef.h>
+#include "perf_counters.h"
+
+#define INPUT_SIZE 224
+#define CHANNELS 3
+#define KERNEL_SIZE 3
+#define CONV_DEPTH 64
+#define CONV_OUT (INPUT_SIZE - KERNEL_SIZE + 1)
+#define POOL_OUT (CONV_OUT / 2)
+#define FLAT_SIZE (POOL_OUT * POOL_OUT * CONV_DEPTH)
+#define FC1_OUT 256
+#define FC2_OUT 100
+#define CONV_TAPS (CHANNELS * KERNEL_SIZE * KERNEL_SIZE)
+
+// fused kernel works on TILE_H x TILE_W conv outputs (all CONV_DEPTH channels) at a time
+#define TILE_H 2
+#define TILE_W 32
+
+// register tile of the SGEMM micro-kernel: GEMM_MR output pixels x GEMM_NR filters
+#define GEMM_MR 4
+#define GEMM_NR 8
+
+// tasks a consumer may run through FC1 together, and the FC1 column block kept in cache per pass
+#define FC_MAX_BATCH 16
+#define FC_BLOCK 4096
+
+// block shape of the block-sparse (BSR) FC weight format
+#define FC_BSR_R 4
+#define FC_BSR_C 4
+
+typedef struct {
+    float input[INPUT_SIZE][INPUT_SIZE][CHANNELS];
+    float fc2_out[FC2_OUT];
+    int input_id;
+} Task;
+
+// per-consumer working memory, allocated once per thread and reused for every task it runs
+typedef struct {
+    float (*conv_out)[CONV_OUT][CONV_DEPTH];   // NULL unless the engine keeps intermediates
+    float (*relu_out)[CONV_OUT][CONV_DEPTH];
+    float (*pool_out)[POOL_OUT][CONV_DEPTH];
+    float (*flat)[FLAT_SIZE];                  // one row per task of a batch
+    float (*fc1_out)[FC1_OUT];
+    int batch_capacity;
+    float pool_row[POOL_OUT][CONV_DEPTH];      // one pooled row, transposed into flat once complete
+    float tile[TILE_H][TILE_W][CONV_DEPTH];
+} Scratch;
+
+typedef struct {
+    float weights[CONV_DEPTH][CHANNELS][KERNEL_SIZE][KERNEL_SIZE];
+    float biases[CONV_DEPTH];
+    // layouts derived from weights by prepare_conv_layer()
+    float taps[CONV_TAPS][CONV_DEPTH];
+    float packed[CONV_DEPTH / GEMM_NR][CONV_TAPS][GEMM_NR];
+    float wino[16][CHANNELS][CONV_DEPTH];
+} ConvLayer;
+
+typedef enum {
+    FC_DENSE,
+    FC_CSR,
+    FC_BSR
+} FcFormat;
+
+// FC weight matrix: dense row-major, or one of the sparse layouts built by fc_sparsify()
+typedef struct {
+    int rows, cols;
+    FcFormat format;
+    long nnz;          // nonzeros in the matrix (counted when it was sparsified)
+    long stored;       // values actually stored (nnz for CSR, blocks * FC_BSR_R * FC_BSR_C for BSR)
+    float* dense;      // rows x cols, NULL once sparsified
+    int* row_ptr;      // rows + 1 (CSR) or rows / FC_BSR_R + 1 (BSR) offsets into col_idx
+    int* col_idx;      // column of each value (CSR) or first column of each block (BSR)
+    float* values;
+    int mapped;        // arrays point into a read-only model file mapping, never unmapped
+} FcWeights;
+
+typedef struct {
+    FcWeights weights;
+    float biases[FC1_OUT];
+} FullyConnectedLayer1;
+
+typedef struct {
+    FcWeights weights;
+    float biases[FC2_OUT];
+} FullyConnectedLayer2;
+
+typedef struct {
+    ConvLayer conv;
+    FullyConnectedLayer1 fc1;
+    FullyConnectedLayer2 fc2;
+} CNNModel;
+
+typedef enum {
+    CONV_REFERENCE,
+    CONV_DIRECT,
+    CONV_GEMM,
+    CONV_AVX2,
+    CONV_AVX512,
+    CONV_WINOGRAD
+} ConvEngine;
+
+typedef float (*FcDotFn)(const float* w, const float* x, int len, float acc);
+typedef void (*FcRowFn)(FcWeights* w, int r0, int r1, void* arg);
+
+typedef enum {
+    PLACE_FIRST_TOUCH,      // each init thread is pinned and touches the rows it (or its FC thread) reads
+    PLACE_INTERLEAVE        // pages are spread round-robin over all NUMA nodes
+} Placement;
+
+typedef void (*ConvTileFn)(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                           int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]);
+
+extern ConvEngine conv_engine;
+extern int keep_intermediates;
+extern int fc_batch_size;
+extern int fc_threads;
+extern FcDotFn fc_dot;
+extern const char* fc_dot_name;
+extern int init_threads;
+extern Placement placement;
+
+void select_conv_engine(void);
+const char* conv_engine_name(ConvEngine engine);
+void select_fc_batch(void);
+void print_fc1_traffic(int tasks_done);
+const char* placement_name(Placement p);
+
+void initialize_weights(CNNModel* model);
+CNNModel* replicate_model(const CNNModel* model, int node);
+void prepare_conv_layer(ConvLayer* conv);
+void pack_gemm_weights(ConvLayer* conv);
+void prepare_winograd(ConvLayer* conv);
+void initialize_input(Task* t, int id);
+void prepare_fc_layers(CNNModel* model);
+
+void fc_weights_alloc(FcWeights* w, int rows, int cols);
+void fc_weights_free(FcWeights* w);
+void fc_weights_replicate(FcWeights* dst, const FcWeights* src, int node);
+void fc_sparsify(FcWeights* w, float max_density, const char* format);
+size_t fc_weights_bytes(const FcWeights* w);
+const char* fc_format_name(FcFormat format);
+float fc_dot_scalar(const float* w, const float* x, int len, float acc);
+float fc_dot_avx2(const float* w, const float* x, int len, float acc);
+float fc_dot_avx512(const float* w, const float* x, int len, float acc);
+FcDotFn best_fc_dot(void);
+void fc_parallel_rows(FcWeights* w, FcRowFn fn, void* arg);
+void fc_forward_batch(const FcWeights* w, const float* bias, const float* const x[], float* const y[], int n,
+                      PerfStage stage);
+
+Scratch* scratch_create(void);
+void scratch_destroy(Scratch* s);
+
+void conv_tile_direct(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                      int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]);
+void conv_tile_gemm(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                    int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]);
+
+void conv_tile_avx2(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                    int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]);
+void conv_tile_avx512(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                      int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]);
+void conv_tile_winograd(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                        int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]);
+int cpu_has_avx2(void);
+int cpu_has_avx512(void);
+ConvEngine best_simd_engine(void);
+
+void conv_reference(const ConvLayer* conv, const Task* t, Scratch* s, float flat[FLAT_SIZE]);
+void conv_relu_pool_fused(ConvEngine engine, const ConvLayer* conv, const Task* t, Scratch* s, float flat[FLAT_SIZE]);
+float check_conv_engine(ConvEngine engine);
+void conv_relu_pool_fc_batch(const CNNModel* model, Task** tasks, int n, Scratch* s);
+void conv_relu_pool_fc(const CNNModel* model, Task* t, Scratch* s);
+
+#endif // CNN_COMMON_H
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Benchmark driver: runs each target binary W times to warm up (page cache, THP, CPU
+// frequency) and N times measured, parses its "Final Performance Metrics" and the child's
+// rusage, and reports median/p95/mean/stddev per metric. The CSV output doubles as the
+// baseline format read back by --baseline.
+
+#define MAX_TARGETS 32
+#define MAX_RUNS 1000
+
+typedef enum {
+    M_WALL,         // "Wall Clock Time" printed by the target: processing only
+    M_TOTAL,        // fork to exit, including model init
+    M_THROUGHPUT,   // tasks done / processing wall time
+    M_CPU_UTIL,     // "CPU Utilization" printed by the target
+    M_PEAK_RSS,     // ru_maxrss of the target and its waited-for children
+    M_COUNT
+} Metric;
+
+static const char* metric_names[M_COUNT] = {"wall_ms", "total_ms", "throughput", "cpu_util", "peak_rss_kb"};
+// +1: higher is a regression, -1: lower is a regression, 0: informational
+static const int metric_worse[M_COUNT] = {+1, +1, -1, 0, +1};
+
+typedef struct {
+    double median, p95, mean, stddev, min, max;
+} Stats;
+
+typedef struct {
+    char name[64];
+    const char* arg;        // extra argument passed to the binary, NULL for none
+    char config[160];       // "Run Config" line printed by the target, if any
+    int runs;
+    int failures;
+    double samples[M_COUNT][MAX_RUNS];
+    Stats stats[M_COUNT];
+} Target;
+
+static const char* default_targets[] = {
+    "baseline", "st", "sp", "mt", "mp", "mpmt_mutex", "mpmt_noSync", "mpmt_lockfree", "mpmt_steal", "cnnrun"
+};
+
+// cnnrun would otherwise load the host profile left by the last --autotune, so one target name
+// would measure whatever configuration was tuned last; without it cnnrun runs its fixed defaults
+static const char* target_arg(const char* name) {
+    return strcmp(name, "cnnrun") == 0 ? "--no-profile" : NULL;
+}
+
+static int runs = 10;
+static int warmup = 2;
+static double threshold = 5.0;
+static const char* bin_dir = "bin";
+static const char* json_path = NULL;
+static const char* csv_path = NULL;
+static const char* baseline_path = NULL;
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+static double parse_value(const char* line, const char* label) {
+    size_t n = strlen(label);
+    if (strncmp(line, label, n) != 0) return -1.0;
+    const char* colon = strchr(line + n, ':');
+    return colon ? atof(colon + 1) : -1.0;
+}
+
+// One run of bin_dir/name with stdout captured in a temporary file; returns 0 on success.
+static int run_once(Target* t, double out[M_COUNT]) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", bin_dir, t->name);
+    FILE* log = tmpfile();
+    if (!log) {
+        perror("tmpfile");
+        exit(1);
+    }
+    fflush(stdout);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fileno(log), STDOUT_FILENO);
+        execl(path, path, t->arg, (char*)NULL);
+        perror(path);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+        perror("fork/wait4");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double wall = -1.0, util = -1.0, done = -1.0;
+    char line[512];
+    rewind(log);
+    while (fgets(line, sizeof(line), log)) {
+        double v;
+        if ((v = parse_value(line, "Wall Clock Time    ")) >= 0) wall = v;
+        if ((v = parse_value(line, "CPU Utilization    ")) >= 0) util = v;
+        if ((v = parse_value(line, "Total Tasks Done   ")) >= 0) done = v;
+        if (strncmp(line, "Run Config         : ", 21) == 0)
+            snprintf(t->config, sizeof(t->config), "%.*s", (int)strcspn(line + 21, "\n"), line + 21);
+    }
+    fclose(log);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || wall <= 0 || done < 0) return -1;
+
+    out[M_WALL] = wall;
+    out[M_TOTAL] = elapsed_ms(start, end);
+    out[M_THROUGHPUT] = done / (wall / 1e3);
+    out[M_CPU_UTIL] = util;
+    out[M_PEAK_RSS] = usage.ru_maxrss;
+    return 0;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// p95 is nearest-rank; stddev is the sample standard deviation
+static Stats compute_stats(const double* samples, int n) {
+    Stats s = {0};
+    if (n == 0) return s;
+    double sorted[MAX_RUNS];
+    memcpy(sorted, samples, sizeof(double) * n);
+    qsort(sorted, n, sizeof(double), cmp_double);
+    s.min = sorted[0];
+    s.max = sorted[n - 1];
+    s.median = (n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    s.p95 = sorted[(int)ceil(0.95 * n) - 1];
+    for (int i = 0; i < n; i++) s.mean += sorted[i];
+    s.mean /= n;
+    for (int i = 0; i < n && n > 1; i++) s.stddev += (sorted[i] - s.mean) * (sorted[i] - s.mean);
+    s.stddev = (n > 1) ? sqrt(s.stddev / (n - 1)) : 0.0;
+    return s;
+}
+
+static void bench_target(Target* t) {
+    double values[M_COUNT];
+    printf("%-16s: ", t->name);
+    fflush(stdout);
+    for (int i = 0; i < warmup; i++)
+        if (run_once(t, values) != 0) t->failures++;
+    for (int i = 0; i < runs; i++) {
+        if (run_once(t, values) != 0) {
+            t->failures++;
+            continue;
+        }
+        for (int m = 0; m < M_COUNT; m++) t->samples[m][t->runs] = values[m];
+        t->runs++;
+    }
+    for (int m = 0; m < M_COUNT; m++) t->stats[m] = compute_stats(t->samples[m], t->runs);
+    const Stats* w = &t->stats[M_WALL];
+    printf("wall %9.2f ms (p95 %9.2f, sd %7.2f)  %8.1f inputs/s  cpu %6.1f %%  rss %7.0f KB  %d run(s)%s\n",
+           w->median, w->p95, w->stddev, t->stats[M_THROUGHPUT].median, t->stats[M_CPU_UTIL].median,
+           t->stats[M_PEAK_RSS].median, t->runs, t->failures ? "  FAILURES" : "");
+}
+
+static void write_csv(const Target* targets, int count) {
+    FILE* f = fopen(csv_path, "w");
+    if (!f) {
+        perror("fopen csv");
+        exit(1);
+    }
+    fprintf(f, "target,metric,runs,median,p95,mean,stddev,min,max,args,config\n");
+    for (int i = 0; i < count; i++)
+        for (int m = 0; m < M_COUNT; m++) {
+            const Stats* s = &targets[i].stats[m];
+            fprintf(f, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%s,\"%s\"\n", targets[i].name, metric_names[m],
+                    targets[i].runs, s->median, s->p95, s->mean, s->stddev, s->min, s->max,
+                    targets[i].arg ? targets[i].arg : "", targets[i].config);
+        }
+    fclose(f);
+}
+
+static void write_json(const Target* targets, int count) {
+    FILE* f = fopen(json_path, "w");
+    if (!f) {
+        perror("fopen json");
+        exit(1);
+    }
+    struct utsname u;
+    uname(&u);
+    fprintf(f, "{\n  \"host\": \"%s\",\n  \"kernel\": \"%s\",\n  \"cpus\": %ld,\n", u.nodename, u.release,
+            sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(f, "  \"runs\": %d,\n  \"warmup\": %d,\n  \"env\": {", runs, warmup);
+    extern char** environ;
+    int first = 1;
+    for (char** e = environ; *e; e++) {
+        const char* eq = strchr(*e, '=');
+        if (strncmp(*e, "CNN_", 4) != 0 || !eq || strpbrk(*e, "\"\\")) continue;
+        fprintf(f, "%s\"%.*s\": \"%s\"", first ? "" : ", ", (int)(eq - *e), *e, eq + 1);
+        first = 0;
+    }
+    fprintf(f, "},\n  \"targets\": [\n");
+    for (int i = 0; i < count; i++) {
+        const Target* t = &targets[i];
+        fprintf(f, "    {\"name\": \"%s\", \"args\": \"%s\", \"config\": \"%s\", \"runs\": %d, \"failures\": %d",
+                t->name, t->arg ? t->arg : "", t->config, t->runs, t->failures);
+        for (int m = 0; m < M_COUNT; m++) {
+            const Stats* s = &t->stats[m];
+            fprintf(f, ",\n     \"%s\": {\"median\": %.4f, \"p95\": %.4f, \"mean\": %.4f, \"stddev\": %.4f, "
+                    "\"min\": %.4f, \"max\": %.4f, \"samples\": [", metric_names[m], s->median, s->p95, s->mean,
+                    s->stddev, s->min, s->max);
+            for (int r = 0; r < t->runs; r++) fprintf(f, "%s%.4f", r ? ", " : "", t->samples[m][r]);
+            fprintf(f, "]}");
+        }
+        fprintf(f, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+// A metric regresses when its median moved in the bad direction by more than --threshold
+// percent and by more than twice the larger of the two standard deviations, so run-to-run
+// noise on a busy host is not reported. Returns the number of regressions.
+static int compare_baseline(const Target* targets, int count) {
+    FILE* f = fopen(baseline_path, "r");
+    if (!f) {
+        perror("fopen baseline");
+        exit(1);
+    }
+    printf("== Baseline Comparison (%s, threshold %.1f %%) ==\n", baseline_path, threshold);
+    int regressions = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64], metric[32];
+        int base_runs;
+        double median, p95, mean, stddev;
+        if (sscanf(line, "%63[^,],%31[^,],%d,%lf,%lf,%lf,%lf", name, metric, &base_runs, &median, &p95, &mean,
+                   &stddev) != 7)
+            continue;
+        // baselines written before the config column have no quoted field
+        char config[160] = "";
+        const char* quote = strchr(line, '"');
+        if (quote) snprintf(config, sizeof(config), "%.*s", (int)strcspn(quote + 1, "\""), quote + 1);
+        for (int i = 0; i < count; i++) {
+            if (strcmp(targets[i].name, name) != 0 || targets[i].runs == 0) continue;
+            if (strcmp(metric, metric_names[0]) == 0 && strcmp(config, targets[i].config) != 0)
+                printf("%-16s config changed: \"%s\" -> \"%s\"\n", name, config, targets[i].config);
+            for (int m = 0; m < M_COUNT; m++) {
+                if (strcmp(metric_names[m], metric) != 0 || median == 0) continue;
+                const Stats* s = &targets[i].stats[m];
+                double change = 100.0 * (s->median - median) / median;
+                double noise = 2 * (s->stddev > stddev ? s->stddev : stddev);
+                int worse = metric_worse[m] * (s->median - median) > 0;
+                int flag = metric_worse[m] != 0 && worse && fabs(change) > threshold &&
+                           fabs(s->median - median) > noise;
+                regressions += flag;
+                printf("%-16s %-12s: %12.2f -> %12.2f (%+6.1f %%)%s\n", name, metric, median, s->median, change,
+                       flag ? "  REGRESSION" : "");
+            }
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--runs=N] [--warmup=W] [--bin-dir=DIR] [--json=FILE] [--csv=FILE]\n"
+            "          [--baseline=FILE] [--threshold=PCT] [target ...]\n"
+            "Targets default to every batch binary in the Makefile; CNN_* variables are passed through.\n"
+            "--baseline reads a CSV written by an earlier --csv and exits with 3 if a metric regressed.\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    static const struct option options[] = {
+        {"runs", required_argument, NULL, 'r'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"bin-dir", required_argument, NULL, 'd'},
+        {"json", required_argument, NULL, 'j'},
+        {"csv", required_argument, NULL, 'c'},
+        {"baseline", required_argument, NULL, 'b'},
+        {"threshold", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'r': runs = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 'd': bin_dir = optarg; break;
+        case 'j': json_path = optarg; break;
+        case 'c': csv_path = optarg; break;
+        case 'b': baseline_path = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        case 'h': usage(argv[0]); return 0;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (runs < 1) runs = 1;
+    if (runs > MAX_RUNS) runs = MAX_RUNS;
+    if (warmup < 0) warmup = 0;
+
+    static Target targets[MAX_TARGETS];
+    int count = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc && count < MAX_TARGETS; i++)
+            snprintf(targets[count++].name, sizeof(targets[0].name), "%s", argv[i]);
+    } else {
+        for (size_t i = 0; i < sizeof(default_targets) / sizeof(default_targets[0]); i++)
+            snprintf(targets[count++].name, sizeof(targets[0].name), "%s", default_targets[i]);
+    }
+
+    for (int i = 0; i < count; i++) targets[i].arg = target_arg(targets[i].name);
+
+    printf("== Benchmark (%d warm-up + %d measured run(s) per target) ==\n", warmup, runs);
+    for (int i = 0; i < count; i++) bench_target(&targets[i]);
+
+    if (csv_path) write_csv(targets, count);
+    if (json_path) write_json(targets, count);
+    int regressions = baseline_path ? compare_baseline(targets, count) : 0;
+    if (regressions) printf("Regressions        : %d\n", regressions);
+
+    for (int i = 0; i < count; i++)
+        if (targets[i].failures) return 1;
+    return regressions ? 3 : 0;
+}
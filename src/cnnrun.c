@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "cnn_common.h"
+#include "task_stats.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "huge_pages.h"
+#include "affinity.h"
+#include "task_queue.h"
+#include "lockfree_queue.h"
+#include "wait_policy.h"
+
+// One runner for every structure in the experiments, configured at run time:
+//   st    producer thread + 1 consumer thread          mt    producer thread + T consumer threads
+//   sp    producer process + 1 worker process          mp    producer process + P worker processes
+//   mpmt  producer process + P worker processes x T threads
+// --sync picks the hand-off: mutex (TaskQueue), lockfree (LFQueue) or none, where there is no
+// producer and worker w generates and runs batches w, w + N, w + 2N, ... of the N workers.
+// Layer shapes stay compile-time constants: every conv/FC kernel is specialized on them.
+
+typedef enum {
+    MODE_ST,
+    MODE_MT,
+    MODE_SP,
+    MODE_MP,
+    MODE_MPMT
+} RunMode;
+
+typedef enum {
+    SYNC_MUTEX,
+    SYNC_LOCKFREE,
+    SYNC_NONE
+} SyncMode;
+
+typedef struct {
+    RunMode mode;
+    SyncMode sync;
+    int procs, threads;     // worker processes (0: consumers are threads of this process) x threads
+    int queue;
+    int inputs;
+} RunConfig;
+
+typedef struct {
+    _Atomic int done;
+    pthread_mutex_t print_mutex;
+} RunShared;
+
+static const char* mode_names[] = {"st", "mt", "sp", "mp", "mpmt"};
+static const char* sync_names[] = {"mutex", "lockfree", "none"};
+
+static RunConfig cfg;
+static CNNModel* model;
+static Task* task_pool;
+static TaskQueue* tq;
+static LFQueue* lfq;
+static RunShared* shared;
+
+static int workers(void) {
+    return (cfg.procs ? cfg.procs : 1) * cfg.threads;
+}
+
+static void put_batch(Task* const batch[], int n) {
+    if (cfg.sync == SYNC_LOCKFREE)
+        lfq_enqueue_batch(lfq, batch, n);
+    else
+        enqueue_batch(tq, batch, n);
+}
+
+static int get_batch(Task* out[]) {
+    if (cfg.sync == SYNC_LOCKFREE)
+        return lfq_dequeue_batch(lfq, out, fc_batch_size);
+    return dequeue_batch(tq, out, fc_batch_size);
+}
+
+static void* producer(void* arg) {
+    Task* batch[FC_MAX_BATCH];
+    int n = 0;
+    for (int i = 0; i < cfg.inputs; i++) {
+        Task* t = &task_pool[i];
+        initialize_input(t, i);
+        batch[n++] = t;
+        if (n == fc_batch_size || i == cfg.inputs - 1) {
+            put_batch(batch, n);
+            n = 0;
+        }
+    }
+    if (cfg.sync == SYNC_LOCKFREE)
+        lfq_close(lfq);
+    else
+        tq_close(tq);
+    return NULL;
+}
+
+static void print_batch(Task** batch, int n, const Scratch* scratch, struct timespec start, struct timespec end,
+                        struct rusage usage_start, struct rusage usage_end) {
+    double user_usec = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) * 1e6 +
+                       (usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec);
+    double sys_usec = (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) * 1e6 +
+                      (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec);
+    double wall_msec = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    double cpu_util = 100.0 * (user_usec + sys_usec) / 1000.0 / wall_msec;
+
+    pthread_mutex_lock(&shared->print_mutex);
+    for (int b = 0; b < n; b++) {
+        Task* t = batch[b];
+        printf("[Consumer %d] Input ID: %d\n", getpid(), t->input_id);
+        printf("Input Patch [0:3][0:3][0]:\n");
+        for (int x = 0; x < 3; x++) {
+            for (int y = 0; y < 3; y++)
+                printf("%.1f ", t->input[x][y][0]);
+            printf("\n");
+        }
+        if (scratch->conv_out && n == 1)
+            printf("Conv Output [0][0][0] = %.2f\n", scratch->conv_out[0][0][0]);
+        else
+            printf("Pool Output [0][0][0] = %.2f\n", scratch->flat[b][0]);
+        printf("fc1[0:5] = ");
+        for (int j = 0; j < 5; j++) printf("%.2f ", scratch->fc1_out[b][j]);
+        printf("\nfc2[0:5] = ");
+        for (int j = 0; j < 5; j++) printf("%.2f ", t->fc2_out[j]);
+        printf("\n");
+    }
+    printf("== Resource Usage ==\n");
+    printf("User CPU Time   : %.3f ms\n", user_usec / 1000.0);
+    printf("System CPU Time : %.3f ms\n", sys_usec / 1000.0);
+    printf("CPU Utilization : %.2f %%\n", cpu_util);
+    printf("Wall Clock Time : %.3f ms\n\n", wall_msec);
+    pthread_mutex_unlock(&shared->print_mutex);
+}
+
+// with --sync=none the worker fills its own batches; tasks of one batch are contiguous
+static int own_batch(int worker, int round, Task* out[]) {
+    int first = (round * workers() + worker) * fc_batch_size;
+    int n = 0;
+    for (int i = first; i < first + fc_batch_size && i < cfg.inputs; i++) {
+        initialize_input(&task_pool[i], i);
+        out[n++] = &task_pool[i];
+    }
+    return n;
+}
+
+static void* consumer(void* arg) {
+    int worker = (int)(intptr_t)arg;
+    Scratch* scratch = scratch_create();
+    for (int round = 0;; round++) {
+        Task* batch[FC_MAX_BATCH];
+        int n = (cfg.sync == SYNC_NONE) ? own_batch(worker, round, batch) : get_batch(batch);
+        if (n == 0) break;
+
+        if (quiet_mode) {
+            TaskClock clock;
+            task_clock_start(&clock);
+            conv_relu_pool_fc_batch(model, batch, n, scratch);
+            task_stats_record(&clock, batch, n);
+            atomic_fetch_add(&shared->done, n);
+            continue;
+        }
+
+        struct timespec start, end;
+        struct rusage usage_start, usage_end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        getrusage(RUSAGE_SELF, &usage_start);
+
+        conv_relu_pool_fc_batch(model, batch, n, scratch);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        getrusage(RUSAGE_SELF, &usage_end);
+        print_batch(batch, n, scratch, start, end, usage_start, usage_end);
+        atomic_fetch_add(&shared->done, n);
+    }
+    scratch_destroy(scratch);
+    return NULL;
+}
+
+static void start_thread(pthread_t* thread, void* (*fn)(void*), int slot, int worker) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    affinity_attr(&attr, slot);
+    pthread_create(thread, &attr, fn, (void*)(intptr_t)worker);
+    pthread_attr_destroy(&attr);
+}
+
+// consumer threads of process p (p = 0 for the in-process modes)
+static void run_consumers(int p) {
+    pthread_t threads[cfg.threads];
+    for (int j = 0; j < cfg.threads; j++)
+        start_thread(&threads[j], consumer, 1 + p * cfg.threads + j, p * cfg.threads + j);
+    for (int j = 0; j < cfg.threads; j++)
+        pthread_join(threads[j], NULL);
+}
+
+static void run(void) {
+    int with_producer = (cfg.sync != SYNC_NONE);
+    if (cfg.procs == 0) {
+        pthread_t prod;
+        if (with_producer) start_thread(&prod, producer, 0, 0);
+        run_consumers(0);
+        if (with_producer) pthread_join(prod, NULL);
+        return;
+    }
+
+    fflush(stdout);
+    pid_t prod_pid = -1;
+    if (with_producer && (prod_pid = fork()) == 0) {
+        affinity_pin_self(0);
+        producer(NULL);
+        exit(0);
+    }
+    pid_t pids[cfg.procs];
+    for (int i = 0; i < cfg.procs; i++) {
+        if ((pids[i] = fork()) == 0) {
+            run_consumers(i);
+            exit(0);
+        }
+    }
+    if (with_producer) waitpid(prod_pid, NULL, 0);
+    for (int i = 0; i < cfg.procs; i++)
+        waitpid(pids[i], NULL, 0);
+}
+
+static int parse_name(const char* value, const char* const names[], int count, const char* option) {
+    for (int i = 0; i < count; i++)
+        if (strcmp(value, names[i]) == 0) return i;
+    fprintf(stderr, "cnnrun: unknown %s '%s'\n", option, value);
+    exit(2);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--mode=st|mt|sp|mp|mpmt] [--procs=P] [--threads=T] [--queue=Q] [--inputs=N]\n"
+            "          [--sync=mutex|lockfree|none] [--batch=B] [--affinity=POLICY]\n"
+            "          [--autotune] [--tune-candidates=N] [--tune-inputs=N] [--profile=PATH] [--no-profile]\n"
+            "--batch and --affinity override CNN_BATCH and CNN_AFFINITY; other CNN_* variables apply as usual.\n"
+            "Options not given on the command line come from the host profile written by --autotune.\n",
+            prog);
+}
+
+static const struct option options[] = {
+    {"mode", required_argument, NULL, 'm'},
+    {"procs", required_argument, NULL, 'p'},
+    {"threads", required_argument, NULL, 't'},
+    {"queue", required_argument, NULL, 'q'},
+    {"inputs", required_argument, NULL, 'n'},
+    {"sync", required_argument, NULL, 's'},
+    {"batch", required_argument, NULL, 'b'},
+    {"affinity", required_argument, NULL, 'a'},
+    {"autotune", no_argument, NULL, 'A'},
+    {"tune-candidates", required_argument, NULL, 'C'},
+    {"tune-inputs", required_argument, NULL, 'I'},
+    {"profile", required_argument, NULL, 'P'},
+    {"no-profile", no_argument, NULL, 'N'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static int autotune_mode = 0;
+static int tune_candidates = 16;
+static int tune_inputs = 8;
+static char profile_path[512];
+static int profile_loaded = 0;
+
+// from the command line env variables are overwritten, from the profile only filled in
+static void apply_option(int opt, const char* value, int overwrite) {
+    switch (opt) {
+    case 'm': cfg.mode = parse_name(value, mode_names, 5, "mode"); break;
+    case 'p': cfg.procs = atoi(value); break;
+    case 't': cfg.threads = atoi(value); break;
+    case 'q': cfg.queue = atoi(value); break;
+    case 'n': cfg.inputs = atoi(value); break;
+    case 's': cfg.sync = parse_name(value, sync_names, 3, "sync"); break;
+    case 'b': setenv("CNN_BATCH", value, overwrite); break;
+    case 'a': setenv("CNN_AFFINITY", value, overwrite); break;
+    }
+}
+
+// CNN_TUNE_PROFILE, or ~/.cnnrun-<hostname>.profile: one profile per machine
+static void default_profile_path(void) {
+    const char* env = getenv("CNN_TUNE_PROFILE");
+    if (env) {
+        snprintf(profile_path, sizeof(profile_path), "%s", env);
+        return;
+    }
+    char host[128] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    const char* home = getenv("HOME");
+    snprintf(profile_path, sizeof(profile_path), "%s/.cnnrun-%s.profile", home ? home : ".", host);
+}
+
+static void load_profile(void) {
+    FILE* f = fopen(profile_path, "r");
+    if (!f) return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char* eq = strchr(line, '=');
+        if (line[0] == '#' || !eq) continue;
+        *eq = '\0';
+        for (const struct option* o = options; o->name; o++)
+            if (o->has_arg == required_argument && strcmp(o->name, line) == 0 && strncmp(line, "tune-", 5) != 0)
+                apply_option(o->val, eq + 1, 0);
+    }
+    fclose(f);
+    profile_loaded = 1;
+}
+
+static void normalize_config(void) {
+    switch (cfg.mode) {
+    case MODE_ST: cfg.procs = 0; cfg.threads = 1; break;
+    case MODE_MT: cfg.procs = 0; break;
+    case MODE_SP: cfg.procs = 1; cfg.threads = 1; break;
+    case MODE_MP: cfg.threads = 1; break;
+    case MODE_MPMT: break;
+    }
+    if (cfg.mode >= MODE_SP && cfg.procs < 1) cfg.procs = 1;
+    if (cfg.threads < 1) cfg.threads = 1;
+    if (cfg.inputs < 1) cfg.inputs = 1;
+    if (cfg.queue < 1) cfg.queue = cfg.inputs;
+}
+
+// The command line is read first for the profile options, then the profile (unless
+// --no-profile or --autotune) is applied, and the remaining command-line options on top.
+static void parse_args(int argc, char** argv) {
+    cfg = (RunConfig){ .mode = MODE_MPMT, .sync = SYNC_MUTEX, .procs = 4, .threads = 4, .queue = 0, .inputs = 40 };
+    default_profile_path();
+
+    int given[argc], n = 0, use_profile = 1;
+    char* values[argc];
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'A': autotune_mode = 1; break;
+        case 'C': tune_candidates = atoi(optarg); break;
+        case 'I': tune_inputs = atoi(optarg); break;
+        case 'P': snprintf(profile_path, sizeof(profile_path), "%s", optarg); break;
+        case 'N': use_profile = 0; break;
+        case 'h': usage(argv[0]); exit(0);
+        case '?': usage(argv[0]); exit(2);
+        default:
+            given[n] = opt;
+            values[n++] = optarg;
+        }
+    }
+    if (use_profile && !autotune_mode) load_profile();
+    for (int i = 0; i < n; i++) apply_option(given[i], values[i], 1);
+    normalize_config();
+}
+
+// Auto-tuning: every candidate runs a short trial in a forked child (stdout to /dev/null) that
+// inherits the already built model; successive halving keeps the faster half each round and
+// doubles the trial length, until one configuration is left. It is written to the profile.
+typedef struct {
+    RunConfig run;
+    int batch;
+    AffinityPolicy affinity;
+    double score;           // inputs per second in the last trial
+} TuneCandidate;
+
+static void candidate_name(const TuneCandidate* c, char* buf, size_t size) {
+    snprintf(buf, size, "%-4s P=%d T=%d Q=%d B=%d %s", mode_names[c->run.mode], c->run.procs, c->run.threads,
+             c->run.queue, c->batch, affinity_policy_name(c->affinity));
+}
+
+static double trial(const TuneCandidate* c, int inputs) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (!freopen("/dev/null", "w", stdout)) exit(1);
+        cfg = c->run;
+        cfg.inputs = inputs;
+        fc_batch_size = c->batch;
+        quiet_mode = 1;
+        setenv("CNN_AFFINITY", affinity_policy_name(c->affinity), 1);
+        select_affinity();
+        task_pool = huge_map(sizeof(Task) * cfg.inputs, 1, REGION_TASKS);
+        atomic_store(&shared->done, 0);
+        if (cfg.queue < fc_batch_size) cfg.queue = fc_batch_size;
+        tq = tq_create(cfg.queue);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        run();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double score = (atomic_load(&shared->done) == inputs) ? inputs / secs : 0.0;
+        if (write(fds[1], &score, sizeof(score)) != sizeof(score)) exit(1);
+        exit(0);
+    }
+    close(fds[1]);
+    double score = 0.0;
+    if (read(fds[0], &score, sizeof(score)) != sizeof(score)) score = 0.0;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return score;
+}
+
+static int by_score(const void* a, const void* b) {
+    double x = ((const TuneCandidate*)a)->score, y = ((const TuneCandidate*)b)->score;
+    return (x < y) - (x > y);
+}
+
+// processes 0 (threads of this process), 1, 2, 4, ... and threads 1, 2, 4, ... with at most
+// twice as many workers as CPUs, queue depths 4/16/64, batches 1/4/16 and, on SMP hosts,
+// the none/compact/scatter affinity policies
+static int enumerate_candidates(TuneCandidate* out, int max) {
+    int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int limit = (2 * ncpu > 2) ? 2 * ncpu : 2;
+    static const int queues[] = {4, 16, 64};
+    static const int batches[] = {1, 4, 16};
+    static const AffinityPolicy policies[] = {AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER};
+    int npolicies = (ncpu > 1) ? 3 : 1;
+    int n = 0;
+    for (int p = 0; p <= ncpu; p = p ? p * 2 : 1)
+        for (int t = 1; (p ? p : 1) * t <= limit; t *= 2)
+            for (int q = 0; q < 3; q++)
+                for (int b = 0; b < 3; b++)
+                    for (int a = 0; a < npolicies && n < max; a++) {
+                        if (batches[b] > queues[q]) continue;
+                        TuneCandidate* c = &out[n++];
+                        c->run = (RunConfig){ .sync = SYNC_MUTEX, .procs = p, .threads = t, .queue = queues[q] };
+                        c->run.mode = (p == 0) ? (t == 1 ? MODE_ST : MODE_MT)
+                                               : (t > 1 ? MODE_MPMT : (p == 1 ? MODE_SP : MODE_MP));
+                        c->batch = batches[b];
+                        c->affinity = policies[a];
+                        c->score = 0.0;
+                    }
+    return n;
+}
+
+static void write_profile(const TuneCandidate* c) {
+    FILE* f = fopen(profile_path, "w");
+    if (!f) {
+        perror("fopen profile");
+        return;
+    }
+    char host[128] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    fprintf(f, "# cnnrun host profile written by --autotune\n");
+    fprintf(f, "# host %s, %ld cpus, %.1f inputs/s\n", host, sysconf(_SC_NPROCESSORS_ONLN), c->score);
+    fprintf(f, "mode=%s\nprocs=%d\nthreads=%d\nqueue=%d\nsync=%s\nbatch=%d\naffinity=%s\n",
+            mode_names[c->run.mode], c->run.procs, c->run.threads, c->run.queue, sync_names[c->run.sync],
+            c->batch, affinity_policy_name(c->affinity));
+    fclose(f);
+}
+
+static void autotune(void) {
+    static TuneCandidate all[1024];
+    int total = enumerate_candidates(all, 1024);
+
+    // a fixed pseudo-random sample, so repeated runs on one host try the same set
+    unsigned seed = 12345;
+    for (int i = total - 1; i > 0; i--) {
+        seed = seed * 1103515245u + 12345u;
+        int j = (seed >> 8) % (i + 1);
+        TuneCandidate tmp = all[i];
+        all[i] = all[j];
+        all[j] = tmp;
+    }
+    int count = (tune_candidates > 0 && tune_candidates < total) ? tune_candidates : total;
+    printf("== Autotune ==\n");
+    printf("Search Space       : %d configurations, %d sampled\n", total, count);
+
+    char name[128];
+    for (int round = 0, inputs = tune_inputs; count > 0; round++, inputs *= 2) {
+        printf("-- Round %d (%d inputs per trial, %d candidate(s))\n", round, inputs, count);
+        for (int i = 0; i < count; i++) {
+            TuneCandidate* c = &all[i];
+            int workers = (c->run.procs ? c->run.procs : 1) * c->run.threads;
+            int n = (inputs > workers * c->batch) ? inputs : workers * c->batch;
+            c->score = trial(c, n);
+            candidate_name(c, name, sizeof(name));
+            printf("  %-40s : %8.1f inputs/s\n", name, c->score);
+        }
+        qsort(all, count, sizeof(TuneCandidate), by_score);
+        if (count <= 2) break;
+        count = (count + 1) / 2;
+    }
+
+    candidate_name(&all[0], name, sizeof(name));
+    printf("Best Configuration : %s (%.1f inputs/s)\n", name, all[0].score);
+    write_profile(&all[0]);
+    printf("Host Profile       : %s (written)\n", profile_path);
+}
+
+static void print_memory_usage(void) {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        perror("fopen");
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+        if (strncmp(line, "VmRSS:", 6) == 0 || strncmp(line, "VmSize:", 7) == 0)
+            printf("%s", line);
+    fclose(fp);
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+
+    model = huge_map(sizeof(CNNModel), 1, REGION_MODEL);
+    task_pool = huge_map(sizeof(Task) * cfg.inputs, 1, REGION_TASKS);
+    shared = mmap(NULL, sizeof(RunShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    atomic_init(&shared->done, 0);
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->print_mutex, &mattr);
+
+    select_wait_policy();
+    select_conv_engine();
+    select_fc_batch();
+    select_task_stats(cfg.inputs);
+    select_perf_counters();
+    select_trace();
+    select_affinity();
+    initialize_weights(model);
+    if (autotune_mode) {
+        autotune();
+        return 0;
+    }
+    if (cfg.queue < fc_batch_size) cfg.queue = fc_batch_size;
+    if (cfg.sync == SYNC_LOCKFREE)
+        lfq = lfq_create(cfg.queue);
+    else if (cfg.sync == SYNC_MUTEX)
+        tq = tq_create(cfg.queue);
+
+    if (profile_loaded) printf("Host Profile       : %s (loaded)\n", profile_path);
+    printf("Run Config         : %s, %d process(es) x %d thread(s), queue %d, sync %s, %d inputs\n",
+           mode_names[cfg.mode], cfg.procs, cfg.threads, cfg.queue, sync_names[cfg.sync], cfg.inputs);
+    print_affinity(cfg.procs ? cfg.procs : 1, cfg.threads);
+
+    struct timespec wall_start, wall_end;
+    struct rusage usage_self_start, usage_self_end, usage_child_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    getrusage(RUSAGE_SELF, &usage_self_start);
+
+    run();
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    getrusage(RUSAGE_SELF, &usage_self_end);
+    getrusage(RUSAGE_CHILDREN, &usage_child_end);
+
+    double user_usec = (usage_self_end.ru_utime.tv_sec - usage_self_start.ru_utime.tv_sec) * 1e6 +
+                       (usage_self_end.ru_utime.tv_usec - usage_self_start.ru_utime.tv_usec) +
+                       (usage_child_end.ru_utime.tv_sec * 1e6 + usage_child_end.ru_utime.tv_usec);
+    double sys_usec = (usage_self_end.ru_stime.tv_sec - usage_self_start.ru_stime.tv_sec) * 1e6 +
+                      (usage_self_end.ru_stime.tv_usec - usage_self_start.ru_stime.tv_usec) +
+                      (usage_child_end.ru_stime.tv_sec * 1e6 + usage_child_end.ru_stime.tv_usec);
+    double wall_msec = (wall_end.tv_sec - wall_start.tv_sec) * 1e3 +
+                       (wall_end.tv_nsec - wall_start.tv_nsec) / 1e6;
+    double cpu_util = 100.0 * (user_usec + sys_usec) / 1000.0 / wall_msec;
+    int done = atomic_load(&shared->done);
+
+    printf("== Final Performance Metrics ==\n");
+    printf("Wall Clock Time    : %.2f ms\n", wall_msec);
+    printf("User CPU Time      : %.2f ms\n", user_usec / 1000.0);
+    printf("System CPU Time    : %.2f ms\n", sys_usec / 1000.0);
+    printf("CPU Utilization    : %.2f %%\n", cpu_util);
+    print_perf_counters();
+    printf("Throughput         : %.1f inputs/s\n", done / (wall_msec / 1e3));
+    printf("Conv Engine        : %s\n", conv_engine_name(conv_engine));
+    printf("Total Tasks Done   : %d\n", done);
+    print_fc1_traffic(done);
+    print_task_stats();
+    print_memory_usage();
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <string.h>
+#include "cnn_common.h"
+
+// Convolution lowered to C = bias + A * B per tile:
+//   A: TILE_H*w x CONV_TAPS  (im2col of the input patches, packed into GEMM_MR-row panels)
+//   B: CONV_TAPS x CONV_DEPTH (filters, packed once into GEMM_NR-column panels)
+// K is only 27, so a tile is a single cache block: the packed A block (~7 KB) and one B panel
+// (~1 KB) stay in L1 while the micro-kernel keeps a GEMM_MR x GEMM_NR block of C in registers.
+
+_Static_assert(CONV_DEPTH % GEMM_NR == 0, "GEMM_NR must divide CONV_DEPTH");
+_Static_assert((TILE_H * 2) % GEMM_MR == 0, "tile rows must split into GEMM_MR panels for even widths");
+
+#define GEMM_MPANELS (TILE_H * TILE_W / GEMM_MR)
+
+void pack_gemm_weights(ConvLayer* conv) {
+    for (int p = 0; p < CONV_DEPTH / GEMM_NR; p++)
+        for (int k = 0; k < CONV_TAPS; k++)
+            for (int n = 0; n < GEMM_NR; n++)
+                conv->packed[p][k][n] = conv->taps[k][p * GEMM_NR + n];
+}
+
+static void pack_patches(const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS], int i0, int j0, int w,
+                         float a[GEMM_MPANELS][CONV_TAPS][GEMM_MR]) {
+    for (int m = 0; m < TILE_H * w; m++) {
+        int i = i0 + m / w, j = j0 + m % w;
+        for (int c = 0; c < CHANNELS; c++)
+            for (int ki = 0; ki < KERNEL_SIZE; ki++)
+                for (int kj = 0; kj < KERNEL_SIZE; kj++)
+                    a[m / GEMM_MR][(c * KERNEL_SIZE + ki) * KERNEL_SIZE + kj][m % GEMM_MR] = input[i + ki][j + kj][c];
+    }
+}
+
+// Accumulates bias first and then k in (c, ki, kj) order, the same order as conv_reference.
+static void gemm_micro_kernel(const float a[CONV_TAPS][GEMM_MR], const float b[CONV_TAPS][GEMM_NR],
+                              const float* bias, float* c[GEMM_MR]) {
+    float acc[GEMM_MR][GEMM_NR];
+    for (int r = 0; r < GEMM_MR; r++)
+        for (int n = 0; n < GEMM_NR; n++)
+            acc[r][n] = bias[n];
+    for (int k = 0; k < CONV_TAPS; k++)
+        for (int r = 0; r < GEMM_MR; r++) {
+            float av = a[k][r];
+            for (int n = 0; n < GEMM_NR; n++)
+                acc[r][n] += av * b[k][n];
+        }
+    for (int r = 0; r < GEMM_MR; r++)
+        memcpy(c[r], acc[r], sizeof(acc[r]));
+}
+
+void conv_tile_gemm(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                    int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]) {
+    float a[GEMM_MPANELS][CONV_TAPS][GEMM_MR];
+    pack_patches(input, i0, j0, w, a);
+
+    int mpanels = TILE_H * w / GEMM_MR;
+    for (int p = 0; p < CONV_DEPTH / GEMM_NR; p++)
+        for (int mp = 0; mp < mpanels; mp++) {
+            float* c[GEMM_MR];
+            for (int r = 0; r < GEMM_MR; r++) {
+                int m = mp * GEMM_MR + r;
+                c[r] = &tile[m / w][m % w][p * GEMM_NR];
+            }
+            gemm_micro_kernel(a[mp], conv->packed[p], &conv->biases[p * GEMM_NR], c);
+        }
+}
@@ -0,0 +1,137 @@
+#include "cnn_common.h"
+
+// Direct 3x3 convolution vectorized across the CONV_DEPTH output channels of the NHWC tile.
+// Each kernel is compiled for its own ISA with a target attribute, so the Makefile can keep
+// building without -march and best_simd_engine() picks the widest one the CPU supports.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+_Static_assert(CONV_DEPTH == 64, "SIMD kernels hold one pixel's 64 channels in 4 zmm / 8 ymm registers");
+
+// AVX-512: 4 pixels x 4 zmm accumulators + 4 zmm of weights per tap
+static inline __attribute__((always_inline, target("avx512f")))
+void block_avx512(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                  int y, int x, float* out, const int np) {
+    __m512 acc[4][4];
+#pragma GCC unroll 4
+    for (int p = 0; p < np; p++)
+#pragma GCC unroll 4
+        for (int v = 0; v < 4; v++)
+            acc[p][v] = _mm512_loadu_ps(&conv->biases[16 * v]);
+
+    for (int c = 0; c < CHANNELS; c++)
+        for (int ki = 0; ki < KERNEL_SIZE; ki++)
+            for (int kj = 0; kj < KERNEL_SIZE; kj++) {
+                const float* tap = conv->taps[(c * KERNEL_SIZE + ki) * KERNEL_SIZE + kj];
+                __m512 w0 = _mm512_loadu_ps(tap);
+                __m512 w1 = _mm512_loadu_ps(tap + 16);
+                __m512 w2 = _mm512_loadu_ps(tap + 32);
+                __m512 w3 = _mm512_loadu_ps(tap + 48);
+#pragma GCC unroll 4
+                for (int p = 0; p < np; p++) {
+                    __m512 in = _mm512_set1_ps(input[y + ki][x + p + kj][c]);
+                    acc[p][0] = _mm512_fmadd_ps(w0, in, acc[p][0]);
+                    acc[p][1] = _mm512_fmadd_ps(w1, in, acc[p][1]);
+                    acc[p][2] = _mm512_fmadd_ps(w2, in, acc[p][2]);
+                    acc[p][3] = _mm512_fmadd_ps(w3, in, acc[p][3]);
+                }
+            }
+
+#pragma GCC unroll 4
+    for (int p = 0; p < np; p++)
+#pragma GCC unroll 4
+        for (int v = 0; v < 4; v++)
+            _mm512_storeu_ps(out + p * CONV_DEPTH + 16 * v, acc[p][v]);
+}
+
+__attribute__((target("avx512f")))
+void conv_tile_avx512(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                      int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]) {
+    for (int i = 0; i < TILE_H; i++) {
+        int j = 0;
+        for (; j + 4 <= w; j += 4)
+            block_avx512(conv, input, i0 + i, j0 + j, tile[i][j], 4);
+        for (; j < w; j += 2)
+            block_avx512(conv, input, i0 + i, j0 + j, tile[i][j], 2);
+    }
+}
+
+// AVX2: 16 ymm registers only, so do 2 pixels x 32 channels per pass (8 accumulators + 4 weights)
+static inline __attribute__((always_inline, target("avx2,fma")))
+void block_avx2(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                int y, int x, int d0, float* out) {
+    __m256 acc[2][4];
+#pragma GCC unroll 2
+    for (int p = 0; p < 2; p++)
+#pragma GCC unroll 4
+        for (int v = 0; v < 4; v++)
+            acc[p][v] = _mm256_loadu_ps(&conv->biases[d0 + 8 * v]);
+
+    for (int c = 0; c < CHANNELS; c++)
+        for (int ki = 0; ki < KERNEL_SIZE; ki++)
+            for (int kj = 0; kj < KERNEL_SIZE; kj++) {
+                const float* tap = conv->taps[(c * KERNEL_SIZE + ki) * KERNEL_SIZE + kj] + d0;
+                __m256 w0 = _mm256_loadu_ps(tap);
+                __m256 w1 = _mm256_loadu_ps(tap + 8);
+                __m256 w2 = _mm256_loadu_ps(tap + 16);
+                __m256 w3 = _mm256_loadu_ps(tap + 24);
+#pragma GCC unroll 2
+                for (int p = 0; p < 2; p++) {
+                    __m256 in = _mm256_broadcast_ss(&input[y + ki][x + p + kj][c]);
+                    acc[p][0] = _mm256_fmadd_ps(w0, in, acc[p][0]);
+                    acc[p][1] = _mm256_fmadd_ps(w1, in, acc[p][1]);
+                    acc[p][2] = _mm256_fmadd_ps(w2, in, acc[p][2]);
+                    acc[p][3] = _mm256_fmadd_ps(w3, in, acc[p][3]);
+                }
+            }
+
+#pragma GCC unroll 2
+    for (int p = 0; p < 2; p++)
+#pragma GCC unroll 4
+        for (int v = 0; v < 4; v++)
+            _mm256_storeu_ps(out + p * CONV_DEPTH + d0 + 8 * v, acc[p][v]);
+}
+
+__attribute__((target("avx2,fma")))
+void conv_tile_avx2(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                    int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]) {
+    for (int i = 0; i < TILE_H; i++)
+        for (int j = 0; j < w; j += 2) {
+            block_avx2(conv, input, i0 + i, j0 + j, 0, tile[i][j]);
+            block_avx2(conv, input, i0 + i, j0 + j, 32, tile[i][j]);
+        }
+}
+
+int cpu_has_avx512(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+
+int cpu_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+#else
+
+void conv_tile_avx512(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                      int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]) {
+    conv_tile_gemm(conv, input, i0, j0, w, tile);
+}
+
+void conv_tile_avx2(const ConvLayer* conv, const float input[INPUT_SIZE][INPUT_SIZE][CHANNELS],
+                    int i0, int j0, int w, float tile[TILE_H][TILE_W][CONV_DEPTH]) {
+    conv_tile_gemm(conv, input, i0, j0, w, tile);
+}
+
+int cpu_has_avx512(void) { return 0; }
+int cpu_has_avx2(void) { return 0; }
+
+#endif
+
+ConvEngine best_simd_engine(void) {
+    if (cpu_has_avx512()) return CONV_AVX512;
+    if (cpu_has_avx2()) return CONV_AVX2;
+    return CONV_GEMM;
+}
@@ -0,0 +1,538 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cnn_common.h"
+#include "huge_pages.h"
+#include "topology.h"
+#include "perf_counters.h"
+
+// FC weight storage and kernels. A matrix starts out dense; fc_sparsify() turns it into
+//   CSR: row_ptr[rows + 1], col_idx[nnz], values[nnz]
+//   BSR: FC_BSR_R x FC_BSR_C blocks with at least one nonzero, stored row-major per block
+// Every format accumulates a row in ascending column order, and the skipped terms are exact
+// zeros, so all three give the same results.
+
+static void* fc_map(size_t size) {
+    return huge_map(size, 1, REGION_FC);
+}
+
+static void fc_unmap(void* p, size_t size) {
+    huge_unmap(p, size);
+}
+
+void fc_weights_alloc(FcWeights* w, int rows, int cols) {
+    memset(w, 0, sizeof(*w));
+    w->rows = rows;
+    w->cols = cols;
+    w->format = FC_DENSE;
+    w->dense = fc_map(sizeof(float) * rows * cols);
+}
+
+static size_t fc_index_count(const FcWeights* w) {
+    return (w->format == FC_BSR) ? w->rows / FC_BSR_R + 1 : (size_t)w->rows + 1;
+}
+
+static size_t fc_col_count(const FcWeights* w) {
+    return (w->format == FC_BSR) ? w->stored / (FC_BSR_R * FC_BSR_C) : w->stored;
+}
+
+size_t fc_weights_bytes(const FcWeights* w) {
+    if (w->format == FC_DENSE)
+        return sizeof(float) * w->rows * w->cols;
+    return sizeof(int) * (fc_index_count(w) + fc_col_count(w)) + sizeof(float) * w->stored;
+}
+
+void fc_weights_free(FcWeights* w) {
+    if (w->mapped) {
+        // owned by the model file mapping
+    } else if (w->format == FC_DENSE) {
+        fc_unmap(w->dense, sizeof(float) * w->rows * w->cols);
+    } else {
+        fc_unmap(w->row_ptr, sizeof(int) * fc_index_count(w));
+        fc_unmap(w->col_idx, sizeof(int) * fc_col_count(w));
+        fc_unmap(w->values, sizeof(float) * w->stored);
+    }
+    w->dense = w->values = NULL;
+    w->row_ptr = w->col_idx = NULL;
+}
+
+static void* fc_map_on(size_t size, int node) {
+    void* p = fc_map(size);
+    topo_bind_memory(p, size ? size : 1, node);
+    return p;
+}
+
+static void copy_dense_rows(FcWeights* w, int r0, int r1, void* arg) {
+    const FcWeights* src = (const FcWeights*)arg;
+    size_t off = (size_t)r0 * w->cols;
+    memcpy(w->dense + off, src->dense + off, sizeof(float) * (r1 - r0) * w->cols);
+}
+
+// Deep copy of src whose pages all live on the given NUMA node. The copy is always owned,
+// also when src points into a model file mapping.
+void fc_weights_replicate(FcWeights* dst, const FcWeights* src, int node) {
+    *dst = *src;
+    dst->mapped = 0;
+    if (src->format == FC_DENSE) {
+        dst->dense = fc_map_on(sizeof(float) * src->rows * src->cols, node);
+        fc_parallel_rows(dst, copy_dense_rows, (void*)src);
+        return;
+    }
+    size_t ptr_bytes = sizeof(int) * fc_index_count(src), idx_bytes = sizeof(int) * fc_col_count(src);
+    dst->row_ptr = memcpy(fc_map_on(ptr_bytes, node), src->row_ptr, ptr_bytes);
+    dst->col_idx = memcpy(fc_map_on(idx_bytes, node), src->col_idx, idx_bytes);
+    dst->values = memcpy(fc_map_on(sizeof(float) * src->stored, node), src->values, sizeof(float) * src->stored);
+}
+
+const char* fc_format_name(FcFormat format) {
+    switch (format) {
+    case FC_DENSE: return "dense";
+    case FC_CSR: return "csr";
+    case FC_BSR: return "bsr";
+    }
+    return "unknown";
+}
+
+// rows per thread are rounded to 16 floats (one cache line of y) and to the BSR block height
+#define FC_ROW_ALIGN 16
+_Static_assert(FC_ROW_ALIGN % FC_BSR_R == 0, "thread row ranges must cover whole BSR blocks");
+
+static int fc_row_chunk(int rows, int nthreads) {
+    int chunk = (rows + nthreads - 1) / nthreads;
+    return (chunk + FC_ROW_ALIGN - 1) / FC_ROW_ALIGN * FC_ROW_ALIGN;
+}
+
+// The CPUs the process may use: those of its main thread, which carries CNN_NUMA's node binding
+// and the cpuset but not the single-CPU pinning CNN_AFFINITY gives producer and consumer threads.
+static int fc_allowed_cpus(int cpus[CPU_SETSIZE]) {
+    cpu_set_t set;
+    if (sched_getaffinity(getpid(), sizeof(set), &set) != 0 && sched_getaffinity(0, sizeof(set), &set) != 0)
+        return 0;
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &set)) cpus[n++] = cpu;
+    return n;
+}
+
+// Member t of an n-thread team may run on the t-th of n equal slices of the allowed CPUs, so
+// consecutive row chunks are spread over the machine (and, with the usual contiguous CPU
+// numbering, over the NUMA nodes) while the teams of different consumers share each slice.
+static void fc_team_pin(pthread_attr_t* attr, int t, int nthreads) {
+    int cpus[CPU_SETSIZE];
+    int ncpu = fc_allowed_cpus(cpus);
+    if (ncpu == 0) return;
+    int first = t * ncpu / nthreads, last = (t + 1) * ncpu / nthreads;
+    if (last <= first) last = first + 1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int k = first; k < last; k++) CPU_SET(cpus[k], &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+typedef struct {
+    FcWeights* w;
+    FcRowFn fn;
+    void* arg;
+    int from, to;
+} InitArgs;
+
+static void* init_thread(void* args) {
+    InitArgs* a = (InitArgs*)args;
+    if (placement == PLACE_INTERLEAVE) topo_interleave_memory();
+    a->fn(a->w, a->from, a->to, a->arg);
+    return NULL;
+}
+
+// Runs fn over row ranges of w on a team of fresh threads, so pinning and memory policy never
+// leak into the caller (forked workers would inherit them). With first-touch placement and
+// CNN_FC_THREADS > 1 the team is the one fc_forward_batch() uses for dense layers: same row
+// ranges on the same CPUs, so every page ends up on the node of the thread that reads it.
+void fc_parallel_rows(FcWeights* w, FcRowFn fn, void* arg) {
+    int nthreads = (placement == PLACE_FIRST_TOUCH && fc_threads > 1) ? fc_threads : init_threads;
+    int chunk = fc_row_chunk(w->rows, nthreads);
+
+    pthread_t threads[nthreads];
+    InitArgs args[nthreads];
+    int started[nthreads];
+    int t = 0;
+    for (int from = 0; from < w->rows; from += chunk, t++) {
+        int to = (from + chunk < w->rows) ? from + chunk : w->rows;
+        args[t] = (InitArgs){ .w = w, .fn = fn, .arg = arg, .from = from, .to = to };
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (placement == PLACE_FIRST_TOUCH && nthreads > 1) fc_team_pin(&attr, t, nthreads);
+        started[t] = (pthread_create(&threads[t], &attr, init_thread, &args[t]) == 0);
+        pthread_attr_destroy(&attr);
+        // no thread (limits, or a cpuset that rejects the pinning): the caller fills the range
+        // itself, without the interleave policy so it does not leak into the caller
+        if (!started[t]) fn(w, from, to, arg);
+    }
+    for (int k = 0; k < t; k++)
+        if (started[k]) pthread_join(threads[k], NULL);
+}
+
+// Sparse conversion runs in three steps: count per row (or block row) in parallel, prefix-sum
+// the counts into row_ptr, then fill each row range in parallel from its row_ptr offset.
+typedef struct {
+    const float* dense;
+    int* counts;
+} SparseBuild;
+
+static void count_row_nonzeros(FcWeights* w, int r0, int r1, void* arg) {
+    SparseBuild* sb = (SparseBuild*)arg;
+    for (int i = r0; i < r1; i++) {
+        const float* row = sb->dense + (size_t)i * w->cols;
+        int n = 0;
+        for (int j = 0; j < w->cols; j++) n += (row[j] != 0.0f);
+        sb->counts[i] = n;
+    }
+}
+
+static int block_nonzero(const float* dense, int cols, int i0, int j0) {
+    for (int r = 0; r < FC_BSR_R; r++)
+        for (int c = 0; c < FC_BSR_C; c++)
+            if (dense[(size_t)(i0 + r) * cols + j0 + c] != 0.0f) return 1;
+    return 0;
+}
+
+static void count_row_blocks(FcWeights* w, int r0, int r1, void* arg) {
+    SparseBuild* sb = (SparseBuild*)arg;
+    for (int i0 = r0; i0 < r1; i0 += FC_BSR_R) {
+        int n = 0;
+        for (int j0 = 0; j0 < w->cols; j0 += FC_BSR_C)
+            n += block_nonzero(sb->dense, w->cols, i0, j0);
+        sb->counts[i0 / FC_BSR_R] = n;
+    }
+}
+
+static long prefix_sum(int* row_ptr, const int* counts, int n) {
+    long k = 0;
+    for (int i = 0; i < n; i++) {
+        row_ptr[i] = k;
+        k += counts[i];
+    }
+    row_ptr[n] = k;
+    return k;
+}
+
+static void fill_csr_rows(FcWeights* w, int r0, int r1, void* arg) {
+    const float* dense = ((SparseBuild*)arg)->dense;
+    for (int i = r0; i < r1; i++) {
+        int k = w->row_ptr[i];
+        const float* row = dense + (size_t)i * w->cols;
+        for (int j = 0; j < w->cols; j++)
+            if (row[j] != 0.0f) {
+                w->col_idx[k] = j;
+                w->values[k++] = row[j];
+            }
+    }
+}
+
+static void build_csr(FcWeights* w, SparseBuild* sb) {
+    w->format = FC_CSR;
+    w->stored = w->nnz;
+    w->row_ptr = fc_map(sizeof(int) * (w->rows + 1));
+    w->col_idx = fc_map(sizeof(int) * w->stored);
+    w->values = fc_map(sizeof(float) * w->stored);
+    prefix_sum(w->row_ptr, sb->counts, w->rows);
+    fc_parallel_rows(w, fill_csr_rows, sb);
+}
+
+static void fill_bsr_rows(FcWeights* w, int r0, int r1, void* arg) {
+    const float* dense = ((SparseBuild*)arg)->dense;
+    for (int i0 = r0; i0 < r1; i0 += FC_BSR_R) {
+        int k = w->row_ptr[i0 / FC_BSR_R];
+        for (int j0 = 0; j0 < w->cols; j0 += FC_BSR_C) {
+            if (!block_nonzero(dense, w->cols, i0, j0)) continue;
+            float* blk = w->values + (size_t)k * FC_BSR_R * FC_BSR_C;
+            for (int r = 0; r < FC_BSR_R; r++)
+                for (int c = 0; c < FC_BSR_C; c++)
+                    blk[r * FC_BSR_C + c] = dense[(size_t)(i0 + r) * w->cols + j0 + c];
+            w->col_idx[k++] = j0;
+        }
+    }
+}
+
+static void build_bsr(FcWeights* w, SparseBuild* sb, long blocks) {
+    w->format = FC_BSR;
+    w->stored = blocks * FC_BSR_R * FC_BSR_C;
+    w->row_ptr = fc_map(sizeof(int) * (w->rows / FC_BSR_R + 1));
+    w->col_idx = fc_map(sizeof(int) * blocks);
+    w->values = fc_map(sizeof(float) * w->stored);
+    prefix_sum(w->row_ptr, sb->counts, w->rows / FC_BSR_R);
+    fc_parallel_rows(w, fill_bsr_rows, sb);
+}
+
+// Converts a dense matrix whose density is below max_density and releases the dense copy.
+// format is "csr", "bsr" or "auto"; auto picks BSR when the nonzero blocks are at least half
+// full (so the padding costs less than CSR's per-value column index) and CSR otherwise.
+void fc_sparsify(FcWeights* w, float max_density, const char* format) {
+    if (w->format != FC_DENSE) return;
+
+    size_t total = (size_t)w->rows * w->cols;
+    int* row_nnz = malloc(sizeof(int) * w->rows);
+    SparseBuild sb = { .dense = w->dense, .counts = row_nnz };
+    fc_parallel_rows(w, count_row_nonzeros, &sb);
+    long nnz = 0;
+    for (int i = 0; i < w->rows; i++) nnz += row_nnz[i];
+    w->nnz = nnz;
+    if ((double)nnz >= max_density * (double)total) {
+        free(row_nnz);
+        return;
+    }
+
+    int bsr_ok = (w->rows % FC_BSR_R == 0) && (w->cols % FC_BSR_C == 0);
+    int use_bsr = 0;
+    long blocks = 0;
+    int* row_blocks = NULL;
+    if (bsr_ok && !(format && strcmp(format, "csr") == 0)) {
+        row_blocks = malloc(sizeof(int) * (w->rows / FC_BSR_R));
+        SparseBuild bb = { .dense = w->dense, .counts = row_blocks };
+        fc_parallel_rows(w, count_row_blocks, &bb);
+        for (int i = 0; i < w->rows / FC_BSR_R; i++) blocks += row_blocks[i];
+        if (format && strcmp(format, "bsr") == 0)
+            use_bsr = 1;
+        else
+            use_bsr = 2 * nnz >= blocks * FC_BSR_R * FC_BSR_C;
+    }
+
+    float* dense = w->dense;
+    if (use_bsr) {
+        sb.counts = row_blocks;
+        build_bsr(w, &sb, blocks);
+    } else {
+        build_csr(w, &sb);
+    }
+    free(row_nnz);
+    free(row_blocks);
+
+    fc_unmap(dense, sizeof(float) * total);
+    w->dense = NULL;
+}
+
+// One pass over the weights serves the whole batch: each FC_BLOCK-wide slice of a weight row
+// is used by all n inputs while it is in L1, and the n matching slices of x stay in L2 across
+// all rows. A single input streams whole rows instead, which keeps the prefetcher running.
+static void fc_dense_rows(const FcWeights* w, const float* const x[], float* const y[], int n, int r0, int r1) {
+    int block = (n == 1) ? w->cols : FC_BLOCK;
+    for (int j0 = 0; j0 < w->cols; j0 += block) {
+        int len = (j0 + block < w->cols) ? block : w->cols - j0;
+        for (int i = r0; i < r1; i++) {
+            const float* row = w->dense + (size_t)i * w->cols + j0;
+            for (int b = 0; b < n; b++)
+                y[b][i] = fc_dot(row, x[b] + j0, len, y[b][i]);
+        }
+    }
+}
+
+static void fc_csr_rows(const FcWeights* w, const float* const x[], float* const y[], int n, int r0, int r1) {
+    for (int i = r0; i < r1; i++) {
+        int k0 = w->row_ptr[i], k1 = w->row_ptr[i + 1];
+        for (int b = 0; b < n; b++) {
+            const float* xb = x[b];
+            float sum = y[b][i];
+            for (int k = k0; k < k1; k++) sum += w->values[k] * xb[w->col_idx[k]];
+            y[b][i] = sum;
+        }
+    }
+}
+
+// r0 and r1 are multiples of FC_BSR_R (fc_forward_batch splits rows in FC_ROW_ALIGN chunks)
+static void fc_bsr_rows(const FcWeights* w, const float* const x[], float* const y[], int n, int r0, int r1) {
+    for (int br = r0 / FC_BSR_R; br < r1 / FC_BSR_R; br++) {
+        int k0 = w->row_ptr[br], k1 = w->row_ptr[br + 1];
+        for (int b = 0; b < n; b++) {
+            const float* xb = x[b];
+            float acc[FC_BSR_R];
+            for (int r = 0; r < FC_BSR_R; r++) acc[r] = y[b][br * FC_BSR_R + r];
+            for (int k = k0; k < k1; k++) {
+                const float* blk = w->values + (size_t)k * FC_BSR_R * FC_BSR_C;
+                const float* xs = xb + w->col_idx[k];
+                for (int r = 0; r < FC_BSR_R; r++)
+                    for (int c = 0; c < FC_BSR_C; c++)
+                        acc[r] += blk[r * FC_BSR_C + c] * xs[c];
+            }
+            for (int r = 0; r < FC_BSR_R; r++) y[b][br * FC_BSR_R + r] = acc[r];
+        }
+    }
+}
+
+static void fc_rows(const FcWeights* w, const float* const x[], float* const y[], int n, int r0, int r1) {
+    switch (w->format) {
+    case FC_DENSE: fc_dense_rows(w, x, y, n, r0, r1); break;
+    case FC_CSR: fc_csr_rows(w, x, y, n, r0, r1); break;
+    case FC_BSR: fc_bsr_rows(w, x, y, n, r0, r1); break;
+    }
+}
+
+// Each consumer thread keeps one team for its whole life: members sleep on start until the
+// caller bumps generation, run their row range of the current job and count pending down. A
+// member whose pthread_create failed is marked absent and its range runs on the caller instead.
+#define FC_MAX_TEAM 64
+
+typedef struct {
+    const FcWeights* w;
+    const float* const* x;
+    float* const* y;
+    int n, chunk;
+    PerfStage stage;
+} FcJob;
+
+typedef struct FcTeam FcTeam;
+
+typedef struct {
+    FcTeam* team;
+    int index;
+    int present;
+    pthread_t thread;
+} FcMember;
+
+struct FcTeam {
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned generation;
+    int pending, stop;
+    int size, first;            // members run ranges first .. first + size - 1
+    FcJob job;
+    FcMember members[FC_MAX_TEAM];
+};
+
+static pthread_key_t team_key;
+static pthread_once_t team_once = PTHREAD_ONCE_INIT;
+static __thread FcTeam* team_local;
+
+static void fc_job_range(const FcJob* job, int k) {
+    int from = k * job->chunk;
+    int to = (from + job->chunk < job->w->rows) ? from + job->chunk : job->w->rows;
+    if (from < to) fc_rows(job->w, job->x, job->y, job->n, from, to);
+}
+
+static void* fc_member(void* args) {
+    FcMember* m = (FcMember*)args;
+    FcTeam* team = m->team;
+    unsigned seen = 0;
+    pthread_mutex_lock(&team->lock);
+    while (1) {
+        while (team->generation == seen && !team->stop)
+            pthread_cond_wait(&team->start, &team->lock);
+        if (team->stop) break;
+        seen = team->generation;
+        FcJob job = team->job;
+        pthread_mutex_unlock(&team->lock);
+        PerfSnapshot perf;
+        perf_start(&perf);
+        fc_job_range(&job, team->first + m->index);
+        if (perf_enabled) {
+            perf_account(job.stage, &perf, 0);
+            perf_flush();
+        }
+        pthread_mutex_lock(&team->lock);
+        if (--team->pending == 0) pthread_cond_signal(&team->done);
+    }
+    pthread_mutex_unlock(&team->lock);
+    return NULL;
+}
+
+// runs when the consumer thread that owns the team exits
+static void fc_team_destroy(void* p) {
+    FcTeam* team = (FcTeam*)p;
+    pthread_mutex_lock(&team->lock);
+    team->stop = 1;
+    pthread_cond_broadcast(&team->start);
+    pthread_mutex_unlock(&team->lock);
+    for (int k = 0; k < team->size; k++)
+        if (team->members[k].present) pthread_join(team->members[k].thread, NULL);
+    pthread_mutex_destroy(&team->lock);
+    pthread_cond_destroy(&team->start);
+    pthread_cond_destroy(&team->done);
+    free(team);
+}
+
+// the team threads do not exist in a forked child; the forking thread builds a new one there
+static void fc_team_after_fork_child(void) {
+    if (team_local) {
+        pthread_setspecific(team_key, NULL);
+        team_local = NULL;
+    }
+}
+
+static void fc_team_init_once(void) {
+    pthread_key_create(&team_key, fc_team_destroy);
+    pthread_atfork(NULL, NULL, fc_team_after_fork_child);
+}
+
+// With first-touch placement every range runs on a member pinned where fc_parallel_rows()
+// placed its pages; otherwise the caller takes range 0 and the members may use any allowed CPU.
+static FcTeam* fc_team(int nthreads) {
+    if (team_local) return team_local;
+    pthread_once(&team_once, fc_team_init_once);
+    FcTeam* team = calloc(1, sizeof(FcTeam));
+    if (!team) {
+        perror("calloc fc team");
+        exit(1);
+    }
+    pthread_mutex_init(&team->lock, NULL);
+    pthread_cond_init(&team->start, NULL);
+    pthread_cond_init(&team->done, NULL);
+    int pinned = (placement == PLACE_FIRST_TOUCH);
+    team->first = pinned ? 0 : 1;
+    team->size = nthreads - team->first;
+    for (int k = 0; k < team->size; k++) {
+        FcMember* m = &team->members[k];
+        m->team = team;
+        m->index = k;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pinned)
+            fc_team_pin(&attr, k, nthreads);
+        else
+            fc_team_pin(&attr, 0, 1);
+        m->present = (pthread_create(&m->thread, &attr, fc_member, m) == 0);
+        pthread_attr_destroy(&attr);
+    }
+    pthread_setspecific(team_key, team);
+    team_local = team;
+    return team;
+}
+
+// y[b] = bias + W * x[b] for b < n. With CNN_FC_THREADS > 1 the output rows of dense layers
+// are split across the calling thread's team (see fc_team()). Sparse layers cost too little to
+// be worth the hand-off.
+void fc_forward_batch(const FcWeights* w, const float* bias, const float* const x[], float* const y[], int n,
+                      PerfStage stage) {
+    for (int b = 0; b < n; b++)
+        memcpy(y[b], bias, sizeof(float) * w->rows);
+
+    int nthreads = (w->format == FC_DENSE) ? fc_threads : 1;
+    if (nthreads > FC_MAX_TEAM) nthreads = FC_MAX_TEAM;
+    int chunk = fc_row_chunk(w->rows, nthreads);
+    if (nthreads == 1 || chunk >= w->rows) {
+        fc_rows(w, x, y, n, 0, w->rows);
+        return;
+    }
+
+    FcTeam* team = fc_team(nthreads);
+    FcJob job = { .w = w, .x = x, .y = y, .n = n, .chunk = chunk, .stage = stage };
+    int present = 0;
+    for (int k = 0; k < team->size; k++) present += team->members[k].present;
+
+    pthread_mutex_lock(&team->lock);
+    team->job = job;
+    team->pending = present;
+    team->generation++;
+    pthread_cond_broadcast(&team->start);
+    pthread_mutex_unlock(&team->lock);
+
+    for (int k = 0; k < team->first; k++) fc_job_range(&job, k);
+    for (int k = 0; k < team->size; k++)
+        if (!team->members[k].present) fc_job_range(&job, team->first + k);
+
+    pthread_mutex_lock(&team->lock);
+    while (team->pending > 0)
+        pthread_cond_wait(&team->done, &team->lock);
+    pthread_mutex_unlock(&team->lock);
+}
@@ -0,0 +1,78 @@
+#include "cnn_common.h"
+
+// Dot products for dense FC rows. A weight row is read once per pass and is far larger than
+// the caches, so the kernels keep four independent accumulators to hide FMA latency and
+// prefetch FC_PREFETCH bytes ahead with the non-temporal hint so the stream does not evict x.
+
+#define FC_PREFETCH 1024
+
+float fc_dot_scalar(const float* w, const float* x, int len, float acc) {
+    for (int j = 0; j < len; j++) acc += w[j] * x[j];
+    return acc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx512f")))
+float fc_dot_avx512(const float* w, const float* x, int len, float acc) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    int j = 0;
+    for (; j + 64 <= len; j += 64) {
+        _mm_prefetch((const char*)(w + j) + FC_PREFETCH, _MM_HINT_NTA);
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(w + j), _mm512_loadu_ps(x + j), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(w + j + 16), _mm512_loadu_ps(x + j + 16), s1);
+        s2 = _mm512_fmadd_ps(_mm512_loadu_ps(w + j + 32), _mm512_loadu_ps(x + j + 32), s2);
+        s3 = _mm512_fmadd_ps(_mm512_loadu_ps(w + j + 48), _mm512_loadu_ps(x + j + 48), s3);
+    }
+    for (; j + 16 <= len; j += 16)
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(w + j), _mm512_loadu_ps(x + j), s0);
+    if (j < len) {
+        __mmask16 m = (__mmask16)((1u << (len - j)) - 1);
+        s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, w + j), _mm512_maskz_loadu_ps(m, x + j), s1);
+    }
+    s0 = _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3));
+    return acc + _mm512_reduce_add_ps(s0);
+}
+
+__attribute__((target("avx2,fma")))
+float fc_dot_avx2(const float* w, const float* x, int len, float acc) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int j = 0;
+    for (; j + 32 <= len; j += 32) {
+        _mm_prefetch((const char*)(w + j) + FC_PREFETCH, _MM_HINT_NTA);
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + j), _mm256_loadu_ps(x + j), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + j + 8), _mm256_loadu_ps(x + j + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(w + j + 16), _mm256_loadu_ps(x + j + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(w + j + 24), _mm256_loadu_ps(x + j + 24), s3);
+    }
+    for (; j + 8 <= len; j += 8)
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + j), _mm256_loadu_ps(x + j), s0);
+    s0 = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    acc += _mm_cvtss_f32(h);
+    for (; j < len; j++) acc += w[j] * x[j];
+    return acc;
+}
+
+#else
+
+float fc_dot_avx512(const float* w, const float* x, int len, float acc) {
+    return fc_dot_scalar(w, x, len, acc);
+}
+
+float fc_dot_avx2(const float* w, const float* x, int len, float acc) {
+    return fc_dot_scalar(w, x, len, acc);
+}
+
+#endif
+
+FcDotFn best_fc_dot(void) {
+    if (cpu_has_avx512()) return fc_dot_avx512;
+    if (cpu_has_avx2()) return fc_dot_avx2;
+    return fc_dot_scalar;
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "huge_pages.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define HUGE_2M (2UL << 20)
+#define HUGE_1G (1UL << 30)
+
+typedef enum {
+    HUGE_AUTO,
+    HUGE_THP,
+    HUGE_OFF
+} HugeMode;
+
+// bytes per region and backing, in a MAP_SHARED page so forked workers' scratch shows up too
+typedef struct {
+    _Atomic long bytes[REGION_COUNT][BACKING_COUNT];
+} HugeStats;
+
+static HugeMode huge_mode = HUGE_AUTO;
+static HugeStats* huge_stats;
+static pthread_once_t huge_once = PTHREAD_ONCE_INIT;
+
+static void huge_init(void) {
+    const char* mode = getenv("CNN_HUGEPAGES");
+    if (mode && strcmp(mode, "thp") == 0)
+        huge_mode = HUGE_THP;
+    else if (mode && strcmp(mode, "off") == 0)
+        huge_mode = HUGE_OFF;
+    else
+        huge_mode = HUGE_AUTO;
+
+    huge_stats = mmap(NULL, sizeof(HugeStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (huge_stats == MAP_FAILED) {
+        perror("mmap huge page stats");
+        exit(1);
+    }
+}
+
+const char* backing_name(Backing b) {
+    switch (b) {
+    case BACKING_HUGETLB_1G: return "hugetlb-1G";
+    case BACKING_HUGETLB_2M: return "hugetlb-2M";
+    case BACKING_THP: return "thp";
+    case BACKING_4K: return "4K";
+    case BACKING_COUNT: break;
+    }
+    return "unknown";
+}
+
+static void* try_hugetlb(size_t size, int flags, size_t page, int shift) {
+    size_t len = (size + page - 1) & ~(page - 1);
+    void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+void* huge_map(size_t size, int shared, HugeRegion region) {
+    pthread_once(&huge_once, huge_init);
+    if (size == 0) size = 1;
+    int flags = (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS;
+
+    void* p = NULL;
+    Backing b = BACKING_4K;
+    if (huge_mode == HUGE_AUTO && size >= HUGE_1G && (p = try_hugetlb(size, flags, HUGE_1G, 30)))
+        b = BACKING_HUGETLB_1G;
+    else if (huge_mode == HUGE_AUTO && size >= HUGE_2M && (p = try_hugetlb(size, flags, HUGE_2M, 21)))
+        b = BACKING_HUGETLB_2M;
+
+    if (!p) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        if (huge_mode != HUGE_OFF && size >= HUGE_2M && madvise(p, size, MADV_HUGEPAGE) == 0)
+            b = BACKING_THP;
+    }
+    atomic_fetch_add(&huge_stats->bytes[region][b], (long)size);
+    return p;
+}
+
+// The backing is not recorded per mapping: a hugetlb mapping rejects a length that is not a
+// multiple of its page size, so each size is tried from the smallest page up.
+void huge_unmap(void* p, size_t size) {
+    if (!p) return;
+    if (size == 0) size = 1;
+    size_t pages[3] = {4096, HUGE_2M, HUGE_1G};
+    for (int i = 0; i < 3; i++) {
+        size_t len = (size + pages[i] - 1) & ~(pages[i] - 1);
+        if (munmap(p, len) == 0 || errno != EINVAL) return;
+    }
+}
+
+static long smaps_kb(const char* key) {
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    size_t n = strlen(key);
+    while (fgets(line, sizeof(line), f))
+        if (strncmp(line, key, n) == 0 && line[n] == ':') {
+            kb = atol(line + n + 1);
+            break;
+        }
+    fclose(f);
+    return kb;
+}
+
+void print_huge_pages(void) {
+    pthread_once(&huge_once, huge_init);
+    static const char* names[REGION_COUNT] = {"model", "task pool", "scratch", "fc weights"};
+    const char* mode = (huge_mode == HUGE_THP) ? "thp" : (huge_mode == HUGE_OFF) ? "off" : "auto";
+    printf("Huge Page Mode     : %s\n", mode);
+    for (int r = 0; r < REGION_COUNT; r++) {
+        char buf[256];
+        int len = 0;
+        for (int b = 0; b < BACKING_COUNT; b++) {
+            long bytes = atomic_load(&huge_stats->bytes[r][b]);
+            if (bytes > 0)
+                len += snprintf(buf + len, sizeof(buf) - len, "%s%s %.2f MB", len ? ", " : "",
+                                backing_name(b), bytes / (1024.0 * 1024.0));
+        }
+        if (len > 0) printf("  %-16s : %s\n", names[r], buf);
+    }
+    long anon = smaps_kb("AnonHugePages"), shmem = smaps_kb("ShmemPmdMapped");
+    if (anon >= 0)
+        printf("THP In Use         : %.2f MB anon, %.2f MB shmem (this process)\n", anon / 1024.0, shmem / 1024.0);
+}
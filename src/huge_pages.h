@@ -0,0 +1,31 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <stddef.h>
+
+// Large-region allocator. Each request tries, in order, MAP_HUGETLB with 1 GB pages (regions of
+// at least 1 GB), MAP_HUGETLB with 2 MB pages (at least 2 MB), then a normal mapping with
+// madvise(MADV_HUGEPAGE) so transparent huge pages can back it. CNN_HUGEPAGES selects the
+// ladder: auto (default), thp (skip hugetlb) or off (plain 4 KB pages).
+typedef enum {
+    BACKING_HUGETLB_1G,
+    BACKING_HUGETLB_2M,
+    BACKING_THP,        // MADV_HUGEPAGE hint; whether THP really applies is up to the kernel
+    BACKING_4K,
+    BACKING_COUNT
+} Backing;
+
+typedef enum {
+    REGION_MODEL,
+    REGION_TASKS,
+    REGION_SCRATCH,
+    REGION_FC,
+    REGION_COUNT
+} HugeRegion;
+
+void* huge_map(size_t size, int shared, HugeRegion region);
+void huge_unmap(void* p, size_t size);
+const char* backing_name(Backing b);
+void print_huge_pages(void);
+
+#endif // HUGE_PAGES_H
@@ -0,0 +1,117 @@
+#include "layer_timer.h"
+
+#ifdef CNN_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// sums over every thread of every process, in a MAP_SHARED page created before any fork
+typedef struct {
+    _Atomic uint64_t ticks[LAYER_COUNT];
+    _Atomic uint64_t calls[LAYER_COUNT];
+    _Atomic int threads;
+} LayerTotals;
+
+static const char* stage_names[LAYER_COUNT] = {"conv", "relu", "pool", "flatten", "fc1", "fc2"};
+
+int layer_timer_tsc = 0;
+__thread LayerTimes* layer_times;
+
+static LayerTotals* totals;
+static pid_t owner;
+static pthread_key_t times_key;
+static uint64_t start_ticks;
+static struct timespec start_raw;
+
+static void fold(LayerTimes* t) {
+    int used = 0;
+    for (int s = 0; s < LAYER_COUNT; s++) {
+        atomic_fetch_add(&totals->ticks[s], t->ticks[s]);
+        atomic_fetch_add(&totals->calls[s], t->calls[s]);
+        used |= t->calls[s] != 0;
+    }
+    if (used) atomic_fetch_add(&totals->threads, 1);
+}
+
+static void thread_exit(void* p) {
+    fold(p);
+    free(p);
+}
+
+LayerTimes* layer_timer_thread(void) {
+    layer_times = calloc(1, sizeof(LayerTimes));
+    pthread_setspecific(times_key, layer_times);
+    return layer_times;
+}
+
+// a forked child starts with a copy of the parent's buffer, which the parent will fold itself
+static void after_fork_child(void) {
+    if (layer_times) memset(layer_times, 0, sizeof(LayerTimes));
+}
+
+static double ticks_per_ms(void) {
+    if (!layer_timer_tsc) return 1e6;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    double ms = (now.tv_sec - start_raw.tv_sec) * 1e3 + (now.tv_nsec - start_raw.tv_nsec) / 1e6;
+    return (layer_timer_now() - start_ticks) / ms;
+}
+
+static void report(void) {
+    if (layer_times) {
+        pthread_setspecific(times_key, NULL);
+        thread_exit(layer_times);
+        layer_times = NULL;
+    }
+    if (getpid() != owner) return;
+
+    uint64_t all = 0;
+    for (int s = 0; s < LAYER_COUNT; s++) all += atomic_load(&totals->ticks[s]);
+    if (all == 0) return;
+
+    double per_ms = ticks_per_ms();
+    printf("== Layer Profile ==\n");
+    if (layer_timer_tsc)
+        printf("Timer Source       : TSC (%.2f GHz)\n", per_ms / 1e6);
+    else
+        printf("Timer Source       : CLOCK_MONOTONIC_RAW\n");
+    printf("Threads Reporting  : %d\n", atomic_load(&totals->threads));
+    for (int s = 0; s < LAYER_COUNT; s++) {
+        uint64_t ticks = atomic_load(&totals->ticks[s]), calls = atomic_load(&totals->calls[s]);
+        printf("%-19s: %10.2f ms (%5.1f %%), %lu call(s), %.2f us/call\n", stage_names[s], ticks / per_ms,
+               100.0 * ticks / all, (unsigned long)calls, calls ? ticks / per_ms * 1e3 / calls : 0.0);
+    }
+    fflush(stdout);
+}
+
+// The rdtsc path needs an invariant TSC (CPUID 0x80000007 EDX bit 8) so readings from
+// different cores and frequencies compare; it is calibrated against CLOCK_MONOTONIC_RAW over
+// the whole run when the table is printed.
+__attribute__((constructor)) static void layer_timer_init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        layer_timer_tsc = (edx >> 8) & 1;
+#endif
+    totals = mmap(NULL, sizeof(LayerTotals), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (totals == MAP_FAILED) {
+        perror("mmap layer timers");
+        exit(1);
+    }
+    owner = getpid();
+    pthread_key_create(&times_key, thread_exit);
+    pthread_atfork(NULL, NULL, after_fork_child);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start_raw);
+    start_ticks = layer_timer_now();
+    atexit(report);
+}
+
+#endif // CNN_PROFILE
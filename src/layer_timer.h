@@ -0,0 +1,65 @@
+#ifndef LAYER_TIMER_H
+#define LAYER_TIMER_H
+
+// Per-layer timers for the forward pass, built with -DCNN_PROFILE (make PROFILE=1). Without it
+// LAYER_TIMER_BEGIN/END expand to nothing. Each thread adds into its own buffer; thread
+// buffers are folded into a MAP_SHARED table when the thread or its process exits, so
+// forked workers count too, and the process that started the program prints the table
+// at exit. Stages a kernel fuses are charged to the stage that does the work: the fused
+// engines apply ReLU inside pooling (relu only counts the copy kept with
+// CNN_KEEP_INTERMEDIATES=1), conv_reference applies ReLU inside conv. flatten is the
+// transpose of pooled values into the channel-major FC1 input.
+typedef enum {
+    LAYER_CONV,
+    LAYER_RELU,
+    LAYER_POOL,
+    LAYER_FLATTEN,
+    LAYER_FC1,
+    LAYER_FC2,
+    LAYER_COUNT
+} LayerStage;
+
+#ifdef CNN_PROFILE
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef struct {
+    uint64_t ticks[LAYER_COUNT];
+    uint64_t calls[LAYER_COUNT];
+} LayerTimes;
+
+extern int layer_timer_tsc;                 // invariant TSC available, else CLOCK_MONOTONIC_RAW ns
+extern __thread LayerTimes* layer_times;
+
+LayerTimes* layer_timer_thread(void);
+
+static inline uint64_t layer_timer_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (layer_timer_tsc) return __rdtsc();
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline void layer_timer_add(LayerStage stage, uint64_t ticks) {
+    LayerTimes* t = layer_times ? layer_times : layer_timer_thread();
+    t->ticks[stage] += ticks;
+    t->calls[stage]++;
+}
+
+#define LAYER_TIMER_BEGIN(stage) uint64_t layer_t0_##stage = layer_timer_now()
+#define LAYER_TIMER_END(stage) layer_timer_add(LAYER_##stage, layer_timer_now() - layer_t0_##stage)
+
+#else
+
+#define LAYER_TIMER_BEGIN(stage) ((void)0)
+#define LAYER_TIMER_END(stage) ((void)0)
+
+#endif // CNN_PROFILE
+
+#endif // LAYER_TIMER_H
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "lockfree_queue.h"
+#include "trace.h"
+
+static size_t lfq_bytes(size_t capacity) {
+    return sizeof(LFQueue) + sizeof(LFSlot) * capacity;
+}
+
+LFQueue* lfq_create(size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+
+    LFQueue* q = mmap(NULL, lfq_bytes(cap), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (q == MAP_FAILED) {
+        perror("mmap queue");
+        exit(1);
+    }
+    q->mask = cap - 1;
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&q->slots[i].seq, i);
+        q->slots[i].task = NULL;
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, 0);
+    wait_word_init(&q->not_empty);
+    wait_word_init(&q->not_full);
+    return q;
+}
+
+void lfq_destroy(LFQueue* q) {
+    munmap(q, lfq_bytes(q->mask + 1));
+}
+
+// slot.seq == pos: free for the producer claiming pos
+// slot.seq == pos + 1: holds the task for the consumer claiming pos
+// after a dequeue the slot is released for pos + capacity, the next lap's producer
+int lfq_try_enqueue(LFQueue* q, Task* t) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        LFSlot* slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long diff = (long)seq - (long)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->task = t;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;   // full: the slot still holds last lap's task
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+int lfq_try_dequeue(LFQueue* q, Task** t) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        LFSlot* slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long diff = (long)seq - (long)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *t = slot->task;
+                atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;   // empty: no producer has published this position yet
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Batch variants claim k consecutive positions with a single CAS. The slots are checked
+// before the CAS; a slot seen ready for this lap stays ready until its position is claimed,
+// so winning the CAS on the same starting position makes all k of them ours.
+int lfq_try_enqueue_batch(LFQueue* q, Task* const tasks[], int n) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        int k = 0;
+        while (k < n && atomic_load_explicit(&q->slots[(pos + k) & q->mask].seq, memory_order_acquire) == pos + k)
+            k++;
+        if (k == 0) {
+            size_t seq = atomic_load_explicit(&q->slots[pos & q->mask].seq, memory_order_acquire);
+            if ((long)seq - (long)pos < 0) return 0;
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            for (int i = 0; i < k; i++) {
+                LFSlot* slot = &q->slots[(pos + i) & q->mask];
+                slot->task = tasks[i];
+                atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+            }
+            return k;
+        }
+    }
+}
+
+int lfq_try_dequeue_batch(LFQueue* q, Task* out[], int max) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        int k = 0;
+        while (k < max && atomic_load_explicit(&q->slots[(pos + k) & q->mask].seq, memory_order_acquire) == pos + k + 1)
+            k++;
+        if (k == 0) {
+            size_t seq = atomic_load_explicit(&q->slots[pos & q->mask].seq, memory_order_acquire);
+            if ((long)seq - (long)(pos + 1) < 0) return 0;
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            for (int i = 0; i < k; i++) {
+                LFSlot* slot = &q->slots[(pos + i) & q->mask];
+                out[i] = slot->task;
+                atomic_store_explicit(&slot->seq, pos + i + q->mask + 1, memory_order_release);
+            }
+            return k;
+        }
+    }
+}
+
+// Blocking wrappers: idle callers wait on the matching WaitWord with the CNN_WAIT policy, and
+// each successful claim issues one wakeup (wake-all when it moved more than one task).
+void lfq_enqueue_batch(LFQueue* q, Task* const tasks[], int n) {
+    long long start = trace_begin();
+    int done = 0;
+    while (done < n) {
+        uint32_t key = wait_prepare(&q->not_full);
+        int k = lfq_try_enqueue_batch(q, tasks + done, n - done);
+        if (k == 0) {
+            wait_for(&q->not_full, key);
+            continue;
+        }
+        done += k;
+        if (k == 1)
+            wake_one(&q->not_empty);
+        else
+            wake_all(&q->not_empty);
+    }
+    trace_end(TRACE_ENQUEUE, start, n);
+}
+
+// Returns 0 once the queue is closed and drained. closed is read before polling, so an
+// empty poll after seeing it set means every task has been claimed.
+int lfq_dequeue_batch(LFQueue* q, Task* out[], int max) {
+    long long start = trace_begin();
+    for (;;) {
+        uint32_t key = wait_prepare(&q->not_empty);
+        int closed = atomic_load(&q->closed);
+        int k = lfq_try_dequeue_batch(q, out, max);
+        if (k > 0) {
+            if (k == 1)
+                wake_one(&q->not_full);
+            else
+                wake_all(&q->not_full);
+            trace_end(TRACE_DEQUEUE, start, k);
+            return k;
+        }
+        if (closed) {
+            trace_end(TRACE_DEQUEUE, start, 0);
+            return 0;
+        }
+        wait_for(&q->not_empty, key);
+    }
+}
+
+void lfq_enqueue(LFQueue* q, Task* t) {
+    lfq_enqueue_batch(q, &t, 1);
+}
+
+int lfq_dequeue(LFQueue* q, Task** t) {
+    return lfq_dequeue_batch(q, t, 1);
+}
+
+void lfq_close(LFQueue* q) {
+    atomic_store(&q->closed, 1);
+    wake_all(&q->not_empty);
+}
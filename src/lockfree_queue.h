@@ -0,0 +1,41 @@
+#ifndef LOCKFREE_QUEUE_H
+#define LOCKFREE_QUEUE_H
+
+#include <stdatomic.h>
+#include "cnn_common.h"
+#include "wait_policy.h"
+
+#define CACHE_LINE 64
+
+// Bounded MPMC ring (D. Vyukov's design). Each slot carries a sequence number that tells
+// producers and consumers whose turn it is, so a position is claimed with one CAS on head or
+// tail and no lock is ever held. Everything lives in one MAP_SHARED mapping and only holds
+// Task pointers into memory mapped before fork(), so any thread of any process can use it.
+typedef struct {
+    _Atomic size_t seq;
+    Task* task;
+} LFSlot;
+
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic size_t head;   // next position to dequeue
+    _Alignas(CACHE_LINE) _Atomic size_t tail;   // next position to enqueue
+    _Alignas(CACHE_LINE) WaitWord not_empty;    // consumers sleep here, bumped per enqueue
+    _Alignas(CACHE_LINE) WaitWord not_full;     // producers sleep here, bumped per dequeue
+    _Atomic int closed;                         // set by lfq_close() once nothing more is enqueued
+    _Alignas(CACHE_LINE) size_t mask;           // capacity - 1, capacity is a power of two
+    LFSlot slots[];
+} LFQueue;
+
+LFQueue* lfq_create(size_t capacity);
+void lfq_destroy(LFQueue* q);
+int lfq_try_enqueue(LFQueue* q, Task* t);
+int lfq_try_dequeue(LFQueue* q, Task** t);
+int lfq_try_enqueue_batch(LFQueue* q, Task* const tasks[], int n);
+int lfq_try_dequeue_batch(LFQueue* q, Task* out[], int max);
+void lfq_enqueue_batch(LFQueue* q, Task* const tasks[], int n);
+int lfq_dequeue_batch(LFQueue* q, Task* out[], int max);
+void lfq_enqueue(LFQueue* q, Task* t);
+int lfq_dequeue(LFQueue* q, Task** t);
+void lfq_close(LFQueue* q);
+
+#endif // LOCKFREE_QUEUE_H
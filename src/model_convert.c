@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include "cnn_common.h"
+#include "model_file.h"
+
+// Builds the model as every variant does at startup (CNN_SPARSE / CNN_SPARSE_FORMAT pick the FC
+// storage) and writes it out for CNN_MODEL=<path>. The FC format is fixed at conversion time.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <model file>\n", argv[0]);
+        return 1;
+    }
+
+    static CNNModel model;
+    select_fc_batch();
+    initialize_weights(&model);
+    save_model_file(&model, argv[1]);
+
+    printf("== Model Written ==\n");
+    printf("Path               : %s\n", argv[1]);
+    for (int l = 0; l < 2; l++) {
+        const FcWeights* w = l ? &model.fc2.weights : &model.fc1.weights;
+        printf("FC%d Weight Format  : %s (%.2f MB)\n", l + 1, fc_format_name(w->format),
+               fc_weights_bytes(w) / (1024.0 * 1024.0));
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "model_file.h"
+
+_Static_assert(sizeof(ModelHeader) <= MODEL_ALIGN, "header must fit in the first aligned block");
+
+static void model_error(const char* path, const char* msg) {
+    fprintf(stderr, "model file %s: %s\n", path, msg);
+    exit(1);
+}
+
+typedef struct {
+    ModelHeader header;
+    const void* data[MODEL_MAX_TENSORS];
+    uint64_t cursor;
+} ModelWriter;
+
+static void add_tensor(ModelWriter* mw, const char* name, ModelDtype dtype, FcFormat layout,
+                       int rank, const uint32_t* dims, const void* data, uint64_t nnz) {
+    ModelHeader* h = &mw->header;
+    ModelTensor* t = &h->tensors[h->tensor_count];
+    mw->data[h->tensor_count++] = data;
+
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->dtype = dtype;
+    t->layout = layout;
+    t->rank = rank;
+    uint64_t count = 1;
+    for (int i = 0; i < rank; i++) {
+        t->dims[i] = dims[i];
+        count *= dims[i];
+    }
+    t->bytes = count * 4;
+    t->nnz = nnz;
+    t->offset = mw->cursor;
+    mw->cursor += (t->bytes + MODEL_ALIGN - 1) / MODEL_ALIGN * MODEL_ALIGN;
+}
+
+static void add_fc_layer(ModelWriter* mw, const char* layer, const FcWeights* w, const float* biases) {
+    char name[32];
+    uint32_t rows[1] = {w->rows};
+    snprintf(name, sizeof(name), "%s.biases", layer);
+    add_tensor(mw, name, MODEL_F32, w->format, 1, rows, biases, 0);
+
+    if (w->format == FC_DENSE) {
+        uint32_t dims[2] = {w->rows, w->cols};
+        snprintf(name, sizeof(name), "%s.dense", layer);
+        add_tensor(mw, name, MODEL_F32, FC_DENSE, 2, dims, w->dense, w->nnz);
+        return;
+    }
+
+    uint32_t ptr_dims[1] = {(w->format == FC_BSR) ? w->rows / FC_BSR_R + 1 : w->rows + 1};
+    uint32_t idx_dims[1] = {(w->format == FC_BSR) ? w->stored / (FC_BSR_R * FC_BSR_C) : w->stored};
+    uint32_t val_dims[3] = {idx_dims[0], FC_BSR_R, FC_BSR_C};
+    snprintf(name, sizeof(name), "%s.row_ptr", layer);
+    add_tensor(mw, name, MODEL_I32, w->format, 1, ptr_dims, w->row_ptr, w->nnz);
+    snprintf(name, sizeof(name), "%s.col_idx", layer);
+    add_tensor(mw, name, MODEL_I32, w->format, 1, idx_dims, w->col_idx, w->nnz);
+    snprintf(name, sizeof(name), "%s.values", layer);
+    add_tensor(mw, name, MODEL_F32, w->format, (w->format == FC_BSR) ? 3 : 1, val_dims, w->values, w->nnz);
+}
+
+// Writes the model with FC layers in whatever format they currently have (see fc_sparsify()).
+void save_model_file(const CNNModel* model, const char* path) {
+    ModelWriter* mw = calloc(1, sizeof(ModelWriter));
+    ModelHeader* h = &mw->header;
+    memcpy(h->magic, MODEL_MAGIC, sizeof(h->magic));
+    h->version = MODEL_VERSION;
+    h->alignment = MODEL_ALIGN;
+    h->header_bytes = sizeof(ModelHeader);
+    h->input_size = INPUT_SIZE;
+    h->channels = CHANNELS;
+    h->kernel_size = KERNEL_SIZE;
+    h->conv_depth = CONV_DEPTH;
+    h->flat_size = FLAT_SIZE;
+    h->fc1_out = FC1_OUT;
+    h->fc2_out = FC2_OUT;
+    h->bsr_r = FC_BSR_R;
+    h->bsr_c = FC_BSR_C;
+    mw->cursor = MODEL_ALIGN;
+
+    uint32_t conv_dims[4] = {CONV_DEPTH, CHANNELS, KERNEL_SIZE, KERNEL_SIZE};
+    add_tensor(mw, "conv.weights", MODEL_F32, FC_DENSE, 4, conv_dims, model->conv.weights, 0);
+    uint32_t bias_dims[1] = {CONV_DEPTH};
+    add_tensor(mw, "conv.biases", MODEL_F32, FC_DENSE, 1, bias_dims, model->conv.biases, 0);
+    add_fc_layer(mw, "fc1", &model->fc1.weights, model->fc1.biases);
+    add_fc_layer(mw, "fc2", &model->fc2.weights, model->fc2.biases);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open model file");
+        exit(1);
+    }
+    int ok = pwrite(fd, h, sizeof(*h), 0) == (ssize_t)sizeof(*h);
+    for (uint32_t i = 0; ok && i < h->tensor_count; i++) {
+        const char* p = mw->data[i];
+        uint64_t off = h->tensors[i].offset, left = h->tensors[i].bytes;
+        while (ok && left > 0) {
+            ssize_t n = pwrite(fd, p, left, off);
+            ok = n > 0;
+            p += n;
+            off += n;
+            left -= n;
+        }
+    }
+    if (!ok || ftruncate(fd, mw->cursor) < 0) {
+        perror("write model file");
+        exit(1);
+    }
+    close(fd);
+    free(mw);
+}
+
+static const ModelTensor* find_tensor(const ModelHeader* h, const char* path, const char* name,
+                                      ModelDtype dtype, uint64_t bytes) {
+    for (uint32_t i = 0; i < h->tensor_count; i++) {
+        const ModelTensor* t = &h->tensors[i];
+        if (strncmp(t->name, name, sizeof(t->name)) != 0) continue;
+        if (t->dtype != dtype || (bytes && t->bytes != bytes))
+            model_error(path, "tensor has an unexpected type or size");
+        return t;
+    }
+    fprintf(stderr, "model file %s: missing tensor %s\n", path, name);
+    exit(1);
+}
+
+static void load_fc_layer(const ModelHeader* h, const char* base, const char* path, const char* layer,
+                          FcWeights* w, float* biases, int rows, int cols) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s.biases", layer);
+    const ModelTensor* b = find_tensor(h, path, name, MODEL_F32, sizeof(float) * rows);
+    memcpy(biases, base + b->offset, b->bytes);
+
+    memset(w, 0, sizeof(*w));
+    w->rows = rows;
+    w->cols = cols;
+    w->format = b->layout;
+    w->mapped = 1;
+
+    if (w->format == FC_DENSE) {
+        snprintf(name, sizeof(name), "%s.dense", layer);
+        const ModelTensor* d = find_tensor(h, path, name, MODEL_F32, sizeof(float) * rows * cols);
+        w->dense = (float*)(base + d->offset);
+        w->nnz = d->nnz;
+        w->stored = (long)rows * cols;
+        return;
+    }
+    if (w->format != FC_CSR && w->format != FC_BSR)
+        model_error(path, "unknown FC layout");
+    if (w->format == FC_BSR && (h->bsr_r != FC_BSR_R || h->bsr_c != FC_BSR_C))
+        model_error(path, "BSR block shape does not match this build");
+
+    size_t ptr_count = (w->format == FC_BSR) ? rows / FC_BSR_R + 1 : rows + 1;
+    snprintf(name, sizeof(name), "%s.row_ptr", layer);
+    const ModelTensor* rp = find_tensor(h, path, name, MODEL_I32, sizeof(int) * ptr_count);
+    snprintf(name, sizeof(name), "%s.col_idx", layer);
+    const ModelTensor* ci = find_tensor(h, path, name, MODEL_I32, 0);
+    snprintf(name, sizeof(name), "%s.values", layer);
+    const ModelTensor* v = find_tensor(h, path, name, MODEL_F32, 0);
+
+    size_t per_index = (w->format == FC_BSR) ? FC_BSR_R * FC_BSR_C : 1;
+    if (v->bytes != ci->bytes * per_index)
+        model_error(path, "values and col_idx sizes disagree");
+    w->row_ptr = (int*)(base + rp->offset);
+    w->col_idx = (int*)(base + ci->offset);
+    w->values = (float*)(base + v->offset);
+    w->nnz = v->nnz;
+    w->stored = v->bytes / sizeof(float);
+    if (w->row_ptr[ptr_count - 1] != (long)(ci->bytes / sizeof(int)))
+        model_error(path, "row_ptr does not cover col_idx");
+
+    // the kernels index x and values with these unchecked, so a damaged file must stop here
+    if (w->row_ptr[0] != 0)
+        model_error(path, "row_ptr does not start at 0");
+    for (size_t i = 1; i < ptr_count; i++)
+        if (w->row_ptr[i] < w->row_ptr[i - 1])
+            model_error(path, "row_ptr is not monotonic");
+    // a BSR index is the first column of its block
+    int max_col = (w->format == FC_BSR) ? cols - FC_BSR_C : cols - 1;
+    for (size_t k = 0; k < ci->bytes / sizeof(int); k++)
+        if (w->col_idx[k] < 0 || w->col_idx[k] > max_col)
+            model_error(path, "col_idx out of range");
+}
+
+static void touch_pages(const void* from, const void* to) {
+    const volatile char* p = (const volatile char*)((uintptr_t)from & ~(uintptr_t)(MODEL_ALIGN - 1));
+    for (; (const void*)p < to; p += MODEL_ALIGN) (void)*p;
+}
+
+// Faults in the rows' pages from the team, so page-cache misses are read in parallel and the
+// pages land according to CNN_PLACEMENT instead of wherever the first consumer runs.
+static void prefault_rows(FcWeights* w, int r0, int r1, void* arg) {
+    if (w->format == FC_DENSE) {
+        touch_pages(w->dense + (size_t)r0 * w->cols, w->dense + (size_t)r1 * w->cols);
+        return;
+    }
+    int per_block = (w->format == FC_BSR) ? FC_BSR_R : 1;
+    size_t k0 = w->row_ptr[r0 / per_block], k1 = w->row_ptr[r1 / per_block];
+    size_t vals = (w->format == FC_BSR) ? FC_BSR_R * FC_BSR_C : 1;
+    touch_pages(w->col_idx + k0, w->col_idx + k1);
+    touch_pages(w->values + k0 * vals, w->values + k1 * vals);
+}
+
+// Maps the file read-only and shared; FC arrays point into the mapping, conv weights (60 KB
+// including the derived layouts) are copied into model so prepare_conv_layer() can fill them in.
+void load_model_file(CNNModel* model, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open model file");
+        exit(1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < MODEL_ALIGN)
+        model_error(path, "too small to hold a header");
+    const char* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap model file");
+        exit(1);
+    }
+    close(fd);
+
+    const ModelHeader* h = (const ModelHeader*)base;
+    if (memcmp(h->magic, MODEL_MAGIC, sizeof(h->magic)) != 0)
+        model_error(path, "bad magic");
+    if (h->version != MODEL_VERSION)
+        model_error(path, "unsupported version");
+    if (h->input_size != INPUT_SIZE || h->channels != CHANNELS || h->kernel_size != KERNEL_SIZE ||
+        h->conv_depth != CONV_DEPTH || h->flat_size != FLAT_SIZE || h->fc1_out != FC1_OUT || h->fc2_out != FC2_OUT)
+        model_error(path, "layer shapes do not match this build");
+    if (h->tensor_count > MODEL_MAX_TENSORS)
+        model_error(path, "too many tensors");
+    for (uint32_t i = 0; i < h->tensor_count; i++) {
+        const ModelTensor* t = &h->tensors[i];
+        if (t->offset % MODEL_ALIGN != 0 || t->offset + t->bytes > (uint64_t)st.st_size)
+            model_error(path, "tensor out of bounds or misaligned");
+    }
+
+    const ModelTensor* cw = find_tensor(h, path, "conv.weights", MODEL_F32, sizeof(model->conv.weights));
+    const ModelTensor* cb = find_tensor(h, path, "conv.biases", MODEL_F32, sizeof(model->conv.biases));
+    memcpy(model->conv.weights, base + cw->offset, cw->bytes);
+    memcpy(model->conv.biases, base + cb->offset, cb->bytes);
+    prepare_conv_layer(&model->conv);
+
+    load_fc_layer(h, base, path, "fc1", &model->fc1.weights, model->fc1.biases, FC1_OUT, FLAT_SIZE);
+    load_fc_layer(h, base, path, "fc2", &model->fc2.weights, model->fc2.biases, FC2_OUT, FC1_OUT);
+
+    // with a single init thread the mapping stays lazy and is faulted in by the first pass
+    if (init_threads > 1) {
+        fc_parallel_rows(&model->fc1.weights, prefault_rows, NULL);
+        fc_parallel_rows(&model->fc2.weights, prefault_rows, NULL);
+    }
+}
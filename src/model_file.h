@@ -0,0 +1,49 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <stdint.h>
+#include "cnn_common.h"
+
+// On-disk model, version 1. Little-endian, native float32/int32:
+//   [ModelHeader, zero padded to MODEL_ALIGN] [tensor 0] [pad] [tensor 1] ...
+// Every tensor starts on a MODEL_ALIGN boundary, so the loader can point FC weights straight
+// into a read-only MAP_SHARED mapping of the file: all processes on the host share the same
+// page-cache pages and startup only faults in what is actually read.
+#define MODEL_MAGIC "CNNMODEL"
+#define MODEL_VERSION 1
+#define MODEL_ALIGN 4096
+#define MODEL_MAX_TENSORS 12
+
+typedef enum {
+    MODEL_F32 = 0,
+    MODEL_I32 = 1
+} ModelDtype;
+
+typedef struct {
+    char name[32];       // "conv.weights", "fc1.values", ...
+    uint32_t dtype;      // ModelDtype
+    uint32_t layout;     // FcFormat of the layer the tensor belongs to (FC_DENSE for conv)
+    uint32_t rank;
+    uint32_t dims[4];
+    uint64_t offset;     // from the start of the file, multiple of MODEL_ALIGN
+    uint64_t bytes;
+    uint64_t nnz;        // nonzeros of the source matrix (FC tensors only)
+} ModelTensor;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint32_t tensor_count;
+    uint32_t header_bytes;
+    // geometry the file was written for, checked against the compiled-in sizes
+    uint32_t input_size, channels, kernel_size, conv_depth;
+    uint32_t flat_size, fc1_out, fc2_out;
+    uint32_t bsr_r, bsr_c;
+    ModelTensor tensors[MODEL_MAX_TENSORS];
+} ModelHeader;
+
+void save_model_file(const CNNModel* model, const char* path);
+void load_model_file(CNNModel* model, const char* path);
+
+#endif // MODEL_FILE_H
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include "cnn_common.h"
+#include "trace.h"
+#include "huge_pages.h"
+#include "affinity.h"
+#include "task_queue.h"
+#include "wait_policy.h"
+
+#define NUM_THREADS 4
+#define NUM_PROCESSES 4
+#define POOL_SIZE 40            // tasks in flight per round, larger jobs run in several rounds
+#define QUEUE_SIZE POOL_SIZE
+#define DEFAULT_SOCKET "/tmp/cnn_daemon.sock"
+
+// Daemon mode: the model is built and the workers are forked once, then jobs arrive on a UNIX
+// socket as text lines
+//   RUN <count> [first_id]   run inputs first_id .. first_id + count - 1, reply with fc2 and timings
+//   STATS                    startup cost and totals so far
+//   SHUTDOWN                 close the queue, reap the workers and exit
+// The same binary is the client: mpmt_daemon run 40 | stats | shutdown (serve is the default).
+
+typedef struct {
+    _Atomic int expected;       // tasks in the current round
+    _Atomic int done;
+    _Atomic long busy_ns;       // consumer time spent in conv_relu_pool_fc_batch this job
+    WaitWord round_done;
+} JobState;
+
+CNNModel* model;
+Task* task_pool;
+TaskQueue* queue;
+JobState* job;
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+void* consumer(void* arg) {
+    Scratch* scratch = scratch_create();
+    while (1) {
+        Task* batch[FC_MAX_BATCH];
+        int n = dequeue_batch(queue, batch, fc_batch_size);
+        if (n == 0) {
+            scratch_destroy(scratch);
+            return NULL;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        conv_relu_pool_fc_batch(model, batch, n, scratch);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        atomic_fetch_add(&job->busy_ns, (long)(elapsed_ms(start, end) * 1e6));
+        if (atomic_fetch_add(&job->done, n) + n == atomic_load(&job->expected))
+            wake_all(&job->round_done);
+    }
+}
+
+static void run_round(int first_id, int count) {
+    atomic_store(&job->done, 0);
+    atomic_store(&job->expected, count);
+
+    Task* batch[FC_MAX_BATCH];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        Task* t = &task_pool[i];
+        initialize_input(t, first_id + i);
+        batch[n++] = t;
+        if (n == fc_batch_size || i == count - 1) {
+            enqueue_batch(queue, batch, n);
+            n = 0;
+        }
+    }
+
+    for (;;) {
+        uint32_t key = wait_prepare(&job->round_done);
+        if (atomic_load(&job->done) == count) break;
+        wait_for(&job->round_done, key);
+    }
+}
+
+static double run_job(FILE* out, int job_id, int first_id, int count) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    atomic_store(&job->busy_ns, 0);
+
+    for (int base = 0; base < count; base += POOL_SIZE) {
+        int n = (count - base < POOL_SIZE) ? count - base : POOL_SIZE;
+        run_round(first_id + base, n);
+        for (int i = 0; i < n; i++) {
+            fprintf(out, "input %d fc2[0:5] =", task_pool[i].input_id);
+            for (int j = 0; j < 5; j++) fprintf(out, " %.2f", task_pool[i].fc2_out[j]);
+            fprintf(out, "\n");
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall_msec = elapsed_ms(start, end);
+    double busy_msec = atomic_load(&job->busy_ns) / 1e6;
+    fprintf(out, "DONE job=%d inputs=%d wall_ms=%.3f per_input_ms=%.3f throughput=%.1f/s busy_ms=%.3f\n",
+            job_id, count, wall_msec, wall_msec / count, count / (wall_msec / 1e3), busy_msec);
+    fflush(out);
+    return wall_msec;
+}
+
+static int open_socket(const char* path, int listening) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        exit(1);
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (listening) {
+        // a socket a live daemon still accepts on is not ours to take; only a stale one is removed
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "a daemon is already serving %s\n", path);
+            exit(1);
+        }
+        if (probe >= 0 && errno == ECONNREFUSED) unlink(path);
+        if (probe >= 0) close(probe);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+            perror("bind");
+            exit(1);
+        }
+    } else if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+static int serve(const char* path) {
+    struct timespec start, ready;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // bound before any worker exists, so a bad CNN_SOCKET exits without leaving consumers behind
+    int listen_fd = open_socket(path, 1);
+
+    model = huge_map(sizeof(CNNModel), 1, REGION_MODEL);
+    task_pool = huge_map(sizeof(Task) * POOL_SIZE, 1, REGION_TASKS);
+    job = mmap(NULL, sizeof(JobState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    queue = tq_create(QUEUE_SIZE);
+    wait_word_init(&job->round_done);
+
+    select_wait_policy();
+    select_conv_engine();
+    select_fc_batch();
+    select_trace();
+    select_affinity();
+    initialize_weights(model);
+
+    fflush(stdout);     // a child would print what is still buffered again at exit()
+    pid_t workers[NUM_PROCESSES];
+    for (int i = 0; i < NUM_PROCESSES; i++) {
+        if ((workers[i] = fork()) == 0) {
+            close(listen_fd);
+            pthread_t threads[NUM_THREADS];
+            for (int j = 0; j < NUM_THREADS; j++) {
+                pthread_attr_t attr;
+                pthread_attr_init(&attr);
+                affinity_attr(&attr, 1 + i * NUM_THREADS + j);
+                pthread_create(&threads[j], &attr, consumer, NULL);
+                pthread_attr_destroy(&attr);
+            }
+            for (int j = 0; j < NUM_THREADS; j++)
+                pthread_join(threads[j], NULL);
+            exit(0);
+        }
+    }
+
+    affinity_pin_self(0);      // after the fork, so the workers do not inherit it
+
+    clock_gettime(CLOCK_MONOTONIC, &ready);
+    double startup_msec = elapsed_ms(start, ready);
+    printf("== Daemon Ready ==\n");
+    printf("Socket             : %s\n", path);
+    printf("Workers            : %d processes x %d threads\n", NUM_PROCESSES, NUM_THREADS);
+    printf("Conv Engine        : %s\n", conv_engine_name(conv_engine));
+    printf("Startup Time       : %.2f ms (model init + pre-fork)\n", startup_msec);
+    print_affinity(NUM_PROCESSES, NUM_THREADS);
+    fflush(stdout);
+
+    signal(SIGPIPE, SIG_IGN);
+    int jobs = 0, running = 1;
+    long inputs = 0;
+    while (running) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        FILE* in = fdopen(fd, "r");
+        FILE* out = fdopen(dup(fd), "w");
+
+        char line[256];
+        while (fgets(line, sizeof(line), in)) {
+            int count, first_id = 0;
+            if (sscanf(line, "RUN %d %d", &count, &first_id) >= 1 && count > 0) {
+                double wall_msec = run_job(out, ++jobs, first_id, count);
+                inputs += count;
+                printf("[Job %d] %d inputs, %.2f ms\n", jobs, count, wall_msec);
+                fflush(stdout);
+            } else if (strncmp(line, "STATS", 5) == 0) {
+                fprintf(out, "STATS startup_ms=%.3f jobs=%d inputs=%ld\n", startup_msec, jobs, inputs);
+                fflush(out);
+            } else if (strncmp(line, "SHUTDOWN", 8) == 0) {
+                fprintf(out, "BYE\n");
+                fflush(out);
+                running = 0;
+                break;
+            } else {
+                fprintf(out, "ERR unknown command\n");
+                fflush(out);
+            }
+        }
+        fclose(in);
+        fclose(out);
+    }
+
+    close(listen_fd);
+    unlink(path);
+    tq_close(queue);
+    for (int i = 0; i < NUM_PROCESSES; i++)
+        waitpid(workers[i], NULL, 0);
+
+    printf("== Daemon Stopped ==\n");
+    printf("Total Jobs         : %d\n", jobs);
+    printf("Total Inputs       : %ld\n", inputs);
+    return 0;
+}
+
+static int client(const char* path, const char* request) {
+    int fd = open_socket(path, 0);
+    FILE* in = fdopen(fd, "r");
+    FILE* out = fdopen(dup(fd), "w");
+    fprintf(out, "%s\n", request);
+    fflush(out);
+
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        fputs(line, stdout);
+        if (strncmp(line, "DONE", 4) == 0 || strncmp(line, "STATS", 5) == 0 ||
+            strncmp(line, "BYE", 3) == 0 || strncmp(line, "ERR", 3) == 0)
+            break;
+    }
+    fclose(in);
+    fclose(out);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* path = getenv("CNN_SOCKET");
+    if (!path) path = DEFAULT_SOCKET;
+
+    if (argc < 2 || strcmp(argv[1], "serve") == 0)
+        return serve(path);
+
+    char request[64];
+    if (strcmp(argv[1], "run") == 0 && argc >= 3)
+        snprintf(request, sizeof(request), "RUN %d %d", atoi(argv[2]), argc >= 4 ? atoi(argv[3]) : 0);
+    else if (strcmp(argv[1], "stats") == 0)
+        snprintf(request, sizeof(request), "STATS");
+    else if (strcmp(argv[1], "shutdown") == 0)
+        snprintf(request, sizeof(request), "SHUTDOWN");
+    else {
+        fprintf(stderr, "usage: %s [serve | run <count> [first_id] | stats | shutdown]\n", argv[0]);
+        return 1;
+    }
+    return client(path, request);
+}
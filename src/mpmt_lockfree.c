@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include "cnn_common.h"
+#include "task_stats.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "huge_pages.h"
+#include "affinity.h"
+#include "lockfree_queue.h"
+#define gettid() syscall(SYS_gettid)
+
+#define NUM_INPUTS 40 
+#define NUM_THREADS 4
+#define NUM_PROCESSES 4    
+#define QUEUE_SIZE NUM_INPUTS
+
+typedef LFQueue TaskQueue;
+
+CNNModel* model;
+Task* task_pool;
+TaskQueue* queue;
+_Atomic int* task_done_count;
+pthread_mutex_t* print_mutex;
+
+void* producer(void* arg) {
+    Task* batch[FC_MAX_BATCH];
+    int n = 0;
+    for (int i = 0; i < NUM_INPUTS; i++) {
+        Task* t = &task_pool[i];
+        initialize_input(t, i);
+        batch[n++] = t;
+        if (n == fc_batch_size || i == NUM_INPUTS - 1) {
+            lfq_enqueue_batch(queue, batch, n);
+            n = 0;
+        }
+    }
+    lfq_close(queue);
+    return NULL;
+}
+
+void* consumer(void* arg) {
+    Scratch* scratch = scratch_create();
+    while (1) {
+        Task* batch[FC_MAX_BATCH];
+        int n = lfq_dequeue_batch(queue, batch, fc_batch_size);
+        if (n == 0) {
+            scratch_destroy(scratch);
+            return NULL;
+        }
+
+        if (quiet_mode) {
+            TaskClock clock;
+            task_clock_start(&clock);
+            conv_relu_pool_fc_batch(model, batch, n, scratch);
+            task_stats_record(&clock, batch, n);
+            atomic_fetch_add(task_done_count, n);
+            continue;
+        }
+
+        struct timespec main_start, main_end;
+        struct rusage main_usage_start, main_usage_end;
+    
+        clock_gettime(CLOCK_MONOTONIC, &main_start);
+        getrusage(RUSAGE_SELF, &main_usage_start);
+
+        conv_relu_pool_fc_batch(model, batch, n, scratch);
+
+        clock_gettime(CLOCK_MONOTONIC, &main_end);
+        getrusage(RUSAGE_SELF, &main_usage_end);
+
+        double user_usec = (main_usage_end.ru_utime.tv_sec - main_usage_start.ru_utime.tv_sec) * 1e6 +
+                           (main_usage_end.ru_utime.tv_usec - main_usage_start.ru_utime.tv_usec);
+        double sys_usec = (main_usage_end.ru_stime.tv_sec - main_usage_start.ru_stime.tv_sec) * 1e6 +
+                          (main_usage_end.ru_stime.tv_usec - main_usage_start.ru_stime.tv_usec);
+        double wall_msec = (main_end.tv_sec - main_start.tv_sec) * 1e3 +
+                           (main_end.tv_nsec - main_start.tv_nsec) / 1e6;
+        double cpu_util = 100.0 * (user_usec + sys_usec) / 1000.0 / wall_msec;
+
+        pthread_mutex_lock(print_mutex);
+        for (int b = 0; b < n; b++) {
+            Task* t = batch[b];
+            printf("[Consumer %d] Input ID: %d\n", getpid(), t->input_id);
+            printf("Input Patch [0:3][0:3][0]:\n");
+            for (int x = 0; x < 3; x++) {
+                for (int y = 0; y < 3; y++)
+                    printf("%.1f ", t->input[x][y][0]);
+                printf("\n");
+            }
+            if (scratch->conv_out && n == 1)
+                printf("Conv Output [0][0][0] = %.2f\n", scratch->conv_out[0][0][0]);
+            else
+                printf("Pool Output [0][0][0] = %.2f\n", scratch->flat[b][0]);
+            printf("fc1[0:5] = ");
+            for (int j = 0; j < 5; j++) printf("%.2f ", scratch->fc1_out[b][j]);
+            printf("\nfc2[0:5] = ");
+            for (int j = 0; j < 5; j++) printf("%.2f ", t->fc2_out[j]);
+            printf("\n");
+        }
+        printf("== Resource Usage ==\n");
+        printf("User CPU Time   : %.3f ms\n", user_usec / 1000.0);
+        printf("System CPU Time : %.3f ms\n", sys_usec / 1000.0);
+        printf("CPU Utilization : %.2f %%\n", cpu_util);
+        printf("Wall Clock Time : %.3f ms\n\n", wall_msec);
+        pthread_mutex_unlock(print_mutex);
+
+        atomic_fetch_add(task_done_count, n);
+    }
+}
+
+void print_memory_usage() {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        perror("fopen");
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "VmRSS:", 6) == 0 || strncmp(line, "VmSize:", 7) == 0) {
+            printf("%s", line);
+        }
+    }
+
+    fclose(fp);
+}
+
+int main() {
+    model = huge_map(sizeof(CNNModel), 1, REGION_MODEL);
+    task_pool = huge_map(sizeof(Task) * NUM_INPUTS, 1, REGION_TASKS);
+    queue = lfq_create(QUEUE_SIZE);
+    task_done_count = mmap(NULL, sizeof(_Atomic int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    print_mutex = mmap(NULL, sizeof(pthread_mutex_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    atomic_store(task_done_count, 0);
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(print_mutex, &mattr);
+
+    select_wait_policy();
+    select_conv_engine();
+    select_fc_batch();
+    select_task_stats(NUM_INPUTS);
+    select_perf_counters();
+    select_trace();
+    select_affinity();
+    initialize_weights(model);
+
+    print_affinity(NUM_PROCESSES, NUM_THREADS);
+
+    struct timespec wall_start, wall_end;
+    struct rusage usage_self_start, usage_self_end, usage_child_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    getrusage(RUSAGE_SELF, &usage_self_start);
+
+    fflush(stdout);     // a child would print what is still buffered again at exit()
+    pid_t producer_pid = fork();
+    if (producer_pid == 0) {
+        affinity_pin_self(0);
+        producer(NULL);
+        exit(0);
+    }
+
+    pid_t workers[NUM_PROCESSES];
+    for (int i = 0; i < NUM_PROCESSES; i++) {
+        if ((workers[i] = fork()) == 0) {
+            pthread_t threads[NUM_THREADS];
+            for (int j = 0; j < NUM_THREADS; j++) {
+                pthread_attr_t attr;
+                pthread_attr_init(&attr);
+                affinity_attr(&attr, 1 + i * NUM_THREADS + j);
+                pthread_create(&threads[j], &attr, consumer, NULL);
+                pthread_attr_destroy(&attr);
+            }
+            for (int j = 0; j < NUM_THREADS; j++)
+                pthread_join(threads[j], NULL);
+            exit(0);
+        }
+    }
+
+    waitpid(producer_pid, NULL, 0);
+    for (int i = 0; i < NUM_PROCESSES; i++)
+        waitpid(workers[i], NULL, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    getrusage(RUSAGE_SELF, &usage_self_end);
+    getrusage(RUSAGE_CHILDREN, &usage_child_end);
+
+    double user_usec = (usage_self_end.ru_utime.tv_sec - usage_self_start.ru_utime.tv_sec) * 1e6 +
+                       (usage_self_end.ru_utime.tv_usec - usage_self_start.ru_utime.tv_usec) +
+                       (usage_child_end.ru_utime.tv_sec * 1e6 + usage_child_end.ru_utime.tv_usec);
+    double sys_usec = (usage_self_end.ru_stime.tv_sec - usage_self_start.ru_stime.tv_sec) * 1e6 +
+                      (usage_self_end.ru_stime.tv_usec - usage_self_start.ru_stime.tv_usec) +
+                      (usage_child_end.ru_stime.tv_sec * 1e6 + usage_child_end.ru_stime.tv_usec);
+    double wall_msec = (wall_end.tv_sec - wall_start.tv_sec) * 1e3 +
+                       (wall_end.tv_nsec - wall_start.tv_nsec) / 1e6;
+    double cpu_util = 100.0 * (user_usec + sys_usec) / 1000.0 / wall_msec;
+
+    printf("== Final Performance Metrics ==\n");
+    printf("Wall Clock Time    : %.2f ms\n", wall_msec);
+    printf("User CPU Time      : %.2f ms\n", user_usec / 1000.0);
+    printf("System CPU Time    : %.2f ms\n", sys_usec / 1000.0);
+    printf("CPU Utilization    : %.2f %%\n", cpu_util);
+    print_perf_counters();
+    printf("Conv Engine        : %s\n", conv_engine_name(conv_engine));
+    printf("Wait Policy        : %s\n", wait_policy_name(wait_policy));
+    printf("Total Tasks Done   : %d\n", atomic_load(task_done_count));
+    print_fc1_traffic(atomic_load(task_done_count));
+    print_task_stats();
+    print_memory_usage();
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <stdatomic.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
@@ -10,172 +11,80 @@
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <time.h>
+#include "cnn_common.h"
+#include "task_stats.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "huge_pages.h"
+#include "affinity.h"
+#include "task_queue.h"
+#include "topology.h"
 #define gettid() syscall(SYS_gettid)
 
-#define INPUT_SIZE 224
-#define CHANNELS 3
-#define KERNEL_SIZE 3
-#define CONV_DEPTH 64
-#define CONV_OUT (INPUT_SIZE - KERNEL_SIZE + 1)
-#define FC1_OUT 256
-#define FC2_OUT 100
 #define NUM_INPUTS 40 
 #define NUM_THREADS 4
 #define NUM_PROCESSES 4    
 #define QUEUE_SIZE NUM_INPUTS
 
-typedef struct {
-    float conv_out[CONV_OUT][CONV_OUT][CONV_DEPTH];
-    float relu_out[CONV_OUT][CONV_OUT][CONV_DEPTH];
-    float pool_out[CONV_OUT/2][CONV_OUT/2][CONV_DEPTH];
-    float flat[(CONV_OUT/2)*(CONV_OUT/2)*CONV_DEPTH];
-    float fc1_out[FC1_OUT];
-    float fc2_out[FC2_OUT];
-    float input[INPUT_SIZE][INPUT_SIZE][CHANNELS];
-    int input_id;
-} Task;
-
-typedef struct {
-    float weights[CONV_DEPTH][CHANNELS][KERNEL_SIZE][KERNEL_SIZE];
-    float biases[CONV_DEPTH];
-} ConvLayer;
-
-typedef struct {
-    float weights[FC1_OUT][(CONV_OUT / 2)*(CONV_OUT / 2)*CONV_DEPTH];
-    float biases[FC1_OUT];
-} FullyConnectedLayer1;
-
-typedef struct {
-    float weights[FC2_OUT][FC1_OUT];
-    float biases[FC2_OUT];
-} FullyConnectedLayer2;
-
-typedef struct {
-    ConvLayer conv;
-    FullyConnectedLayer1 fc1;
-    FullyConnectedLayer2 fc2;
-} CNNModel;
-
-typedef struct {
-    Task* buffer[QUEUE_SIZE];
-    int front, rear, count;
-    pthread_mutex_t mutex;
-    pthread_cond_t not_empty, not_full;
-} TaskQueue;
+// CNN_NUMA=1: worker process i runs on node i % num_nodes with its CPUs and memory bound there,
+// takes tasks from that node's queue and reads that node's model replica. Otherwise there is one
+// "node" covering the whole machine, whose queue and model are the shared ones.
+int numa_mode = 0;
+int num_nodes = 1;
+NumaNode nodes[TOPO_MAX_NODES];
+TaskQueue* node_queue[TOPO_MAX_NODES];
+CNNModel* node_model[TOPO_MAX_NODES];
 
 CNNModel* model;
 Task* task_pool;
 TaskQueue* queue;
 int* task_done_count;
-_Atomic int* producer_finished;
 pthread_mutex_t* task_done_mutex;
 pthread_mutex_t* print_mutex;
 
-void initialize_weights(CNNModel* model) {
-    int kernel[3][3] = {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}};
-    for (int d = 0; d < CONV_DEPTH; d++) {
-        model->conv.biases[d] = 1.0f;
-        for (int c = 0; c < CHANNELS; c++)
-            for (int i = 0; i < KERNEL_SIZE; i++)
-                for (int j = 0; j < KERNEL_SIZE; j++)
-                    model->conv.weights[d][c][i][j] = kernel[i][j];
-    }
-
-    for (int i = 0; i < FC1_OUT; i++) {
-        model->fc1.biases[i] = 1.0f;
-        for (int j = 0; j < (CONV_OUT / 2)*(CONV_OUT / 2)*CONV_DEPTH; j++)
-            model->fc1.weights[i][j] = (i == j) ? 1.0f : 0.0f;
-    }
-
-    for (int i = 0; i < FC2_OUT; i++) {
-        model->fc2.biases[i] = 1.0f;
-        for (int j = 0; j < FC1_OUT; j++)
-            model->fc2.weights[i][j] = (i == j) ? 1.0f : 0.0f;
-    }
-}
-
-void initialize_input(Task* t, int id) {
-    float center = 9.0f * (id + 1);
-    t->input_id = id;
-    for (int c = 0; c < CHANNELS; c++)
-        for (int i = 0; i < INPUT_SIZE; i++)
-            for (int j = 0; j < INPUT_SIZE; j++)
-                t->input[i][j][c] = (i == 1 && j == 1) ? center : 1.0f;
-}
-
-void conv_relu_pool_fc(Task* t) {
-    for (int d = 0; d < CONV_DEPTH; d++)
-        for (int i = 0; i < CONV_OUT; i++)
-            for (int j = 0; j < CONV_OUT; j++) {
-                float sum = model->conv.biases[d];
-                for (int c = 0; c < CHANNELS; c++)
-                    for (int ki = 0; ki < KERNEL_SIZE; ki++)
-                        for (int kj = 0; kj < KERNEL_SIZE; kj++)
-                            sum += model->conv.weights[d][c][ki][kj] * t->input[i + ki][j + kj][c];
-                t->conv_out[i][j][d] = sum;
-                t->relu_out[i][j][d] = (sum > 0) ? sum : 0;
-            }
-    int idx = 0;
-    for (int d = 0; d < CONV_DEPTH; d++)
-        for (int x = 0; x < CONV_OUT; x += 2)
-            for (int y = 0; y < CONV_OUT; y += 2) {
-                float maxval = t->relu_out[x][y][d];
-                for (int dx = 0; dx < 2; dx++)
-                    for (int dy = 0; dy < 2; dy++)
-                        if (t->relu_out[x + dx][y + dy][d] > maxval)
-                            maxval = t->relu_out[x + dx][y + dy][d];
-                t->pool_out[x/2][y/2][d] = maxval;
-                t->flat[idx++] = maxval;
-            }
-    for (int i = 0; i < FC1_OUT; i++) {
-        float sum = model->fc1.biases[i];
-        for (int j = 0; j < idx; j++) sum += model->fc1.weights[i][j] * t->flat[j];
-        t->fc1_out[i] = sum;
-    }
-    for (int i = 0; i < FC2_OUT; i++) {
-        float sum = model->fc2.biases[i];
-        for (int j = 0; j < FC1_OUT; j++) sum += model->fc2.weights[i][j] * t->fc1_out[j];
-        t->fc2_out[i] = sum;
-    }
-}
-
+// batches are dealt round-robin over the worker processes and go to the queue of that worker's
+// node (i % num_nodes), so each node gets batches in proportion to its workers also when
+// NUM_PROCESSES is not a multiple of num_nodes
 void* producer(void* arg) {
+    Task* batch[FC_MAX_BATCH];
+    int n = 0, batches = 0;
     for (int i = 0; i < NUM_INPUTS; i++) {
         Task* t = &task_pool[i];
         initialize_input(t, i);
-        pthread_mutex_lock(&queue->mutex);
-        while (queue->count == QUEUE_SIZE)
-            pthread_cond_wait(&queue->not_full, &queue->mutex);
-        queue->buffer[queue->rear] = t;
-        queue->rear = (queue->rear + 1) % QUEUE_SIZE;
-        queue->count++;
-        pthread_cond_signal(&queue->not_empty);
-        pthread_mutex_unlock(&queue->mutex);
+        batch[n++] = t;
+        if (n == fc_batch_size || i == NUM_INPUTS - 1) {
+            enqueue_batch(node_queue[batches++ % NUM_PROCESSES % num_nodes], batch, n);
+            n = 0;
+        }
     }
-    atomic_store(producer_finished, 1);
-    pthread_cond_broadcast(&queue->not_empty);
+    for (int k = 0; k < num_nodes; k++)
+        tq_close(node_queue[k]);
     return NULL;
 }
 
 void* consumer(void* arg) {
+    int node = (int)(intptr_t)arg;
+    TaskQueue* queue = node_queue[node];
+    const CNNModel* model = node_model[node];
+    Scratch* scratch = scratch_create();
     while (1) {
-        pthread_mutex_lock(&queue->mutex);
-        if (atomic_load(producer_finished) && queue->count == 0) {
-            pthread_mutex_unlock(&queue->mutex);
+        Task* batch[FC_MAX_BATCH];
+        int n = dequeue_batch(queue, batch, fc_batch_size);
+        if (n == 0) {
+            scratch_destroy(scratch);
             return NULL;
         }
-        while (queue->count == 0) {
-            if (atomic_load(producer_finished)) {
-                pthread_mutex_unlock(&queue->mutex);
-                return NULL;
-            }
-            pthread_cond_wait(&queue->not_empty, &queue->mutex);
+
+        if (quiet_mode) {
+            TaskClock clock;
+            task_clock_start(&clock);
+            conv_relu_pool_fc_batch(model, batch, n, scratch);
+            task_stats_record(&clock, batch, n);
+            pthread_mutex_lock(task_done_mutex);
+            *task_done_count += n;
+            pthread_mutex_unlock(task_done_mutex);
+            continue;
         }
-        Task* t = queue->buffer[queue->front];
-        queue->front = (queue->front + 1) % QUEUE_SIZE;
-        queue->count--;
-        pthread_cond_signal(&queue->not_full);
-        pthread_mutex_unlock(&queue->mutex);
 
         struct timespec main_start, main_end;
         struct rusage main_usage_start, main_usage_end;
@@ -183,7 +92,7 @@ void* consumer(void* arg) {
         clock_gettime(CLOCK_MONOTONIC, &main_start);
         getrusage(RUSAGE_SELF, &main_usage_start);
 
-        conv_relu_pool_fc(t);
+        conv_relu_pool_fc_batch(model, batch, n, scratch);
 
         clock_gettime(CLOCK_MONOTONIC, &main_end);
         getrusage(RUSAGE_SELF, &main_usage_end);
@@ -197,19 +106,25 @@ void* consumer(void* arg) {
         double cpu_util = 100.0 * (user_usec + sys_usec) / 1000.0 / wall_msec;
 
         pthread_mutex_lock(print_mutex);
-        printf("[Consumer %d] Input ID: %d\n", getpid(), t->input_id);
-        printf("Input Patch [0:3][0:3][0]:\n");
-        for (int x = 0; x < 3; x++) {
-            for (int y = 0; y < 3; y++)
-                printf("%.1f ", t->input[x][y][0]);
+        for (int b = 0; b < n; b++) {
+            Task* t = batch[b];
+            printf("[Consumer %d] Input ID: %d\n", getpid(), t->input_id);
+            printf("Input Patch [0:3][0:3][0]:\n");
+            for (int x = 0; x < 3; x++) {
+                for (int y = 0; y < 3; y++)
+                    printf("%.1f ", t->input[x][y][0]);
+                printf("\n");
+            }
+            if (scratch->conv_out && n == 1)
+                printf("Conv Output [0][0][0] = %.2f\n", scratch->conv_out[0][0][0]);
+            else
+                printf("Pool Output [0][0][0] = %.2f\n", scratch->flat[b][0]);
+            printf("fc1[0:5] = ");
+            for (int j = 0; j < 5; j++) printf("%.2f ", scratch->fc1_out[b][j]);
+            printf("\nfc2[0:5] = ");
+            for (int j = 0; j < 5; j++) printf("%.2f ", t->fc2_out[j]);
             printf("\n");
         }
-        printf("Conv Output [0][0][0] = %.2f\n", t->conv_out[0][0][0]);
-        printf("fc1[0:5] = ");
-        for (int j = 0; j < 5; j++) printf("%.2f ", t->fc1_out[j]);
-        printf("\nfc2[0:5] = ");
-        for (int j = 0; j < 5; j++) printf("%.2f ", t->fc2_out[j]);
-        printf("\n");
         printf("== Resource Usage ==\n");
         printf("User CPU Time   : %.3f ms\n", user_usec / 1000.0);
         printf("System CPU Time : %.3f ms\n", sys_usec / 1000.0);
@@ -218,7 +133,7 @@ void* consumer(void* arg) {
         pthread_mutex_unlock(print_mutex);
 
         pthread_mutex_lock(task_done_mutex);
-        (*task_done_count)++;
+        *task_done_count += n;
         pthread_mutex_unlock(task_done_mutex);
     }
 }
@@ -241,40 +156,68 @@ void print_memory_usage() {
 }
 
 int main() {
-    model = mmap(NULL, sizeof(CNNModel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    task_pool = mmap(NULL, sizeof(Task) * NUM_INPUTS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    queue = mmap(NULL, sizeof(TaskQueue), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    model = huge_map(sizeof(CNNModel), 1, REGION_MODEL);
+    task_pool = huge_map(sizeof(Task) * NUM_INPUTS, 1, REGION_TASKS);
+    queue = tq_create(QUEUE_SIZE);
     task_done_count = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    producer_finished = mmap(NULL, sizeof(_Atomic int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     task_done_mutex = mmap(NULL, sizeof(pthread_mutex_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     print_mutex = mmap(NULL, sizeof(pthread_mutex_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
     *task_done_count = 0;
-    atomic_store(producer_finished, 0);
 
     pthread_mutexattr_t mattr;
     pthread_mutexattr_init(&mattr);
     pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&queue->mutex, &mattr);
     pthread_mutex_init(task_done_mutex, &mattr);
     pthread_mutex_init(print_mutex, &mattr);
 
-    pthread_condattr_t cattr;
-    pthread_condattr_init(&cattr);
-    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
-    pthread_cond_init(&queue->not_empty, &cattr);
-    pthread_cond_init(&queue->not_full, &cattr);
-
-    queue->front = queue->rear = queue->count = 0;
+    select_conv_engine();
+    select_fc_batch();
+    select_task_stats(NUM_INPUTS);
+    select_perf_counters();
+    select_trace();
+    select_affinity();
     initialize_weights(model);
 
+    const char* numa = getenv("CNN_NUMA");
+    numa_mode = (numa && atoi(numa) != 0);
+    node_queue[0] = queue;
+    node_model[0] = model;
+    if (numa_mode) {
+        num_nodes = topo_numa_nodes(nodes, TOPO_MAX_NODES);
+        if (num_nodes > NUM_PROCESSES) num_nodes = NUM_PROCESSES;
+        // a single node keeps the shared model; more get one replica each, including node 0,
+        // since the original was placed by CNN_PLACEMENT rather than on one node
+        for (int k = 0; k < num_nodes && num_nodes > 1; k++) {
+            node_model[k] = replicate_model(model, nodes[k].id);
+            if (k > 0) node_queue[k] = tq_create(QUEUE_SIZE);
+        }
+        if (num_nodes > 1) {
+            fc_weights_free(&model->fc1.weights);
+            fc_weights_free(&model->fc2.weights);
+        }
+        printf("NUMA Mode          : %d node(s), per-node queue%s\n", num_nodes,
+               num_nodes > 1 ? " + model replica" : "");
+        for (int k = 0; k < num_nodes; k++)
+            printf("  node %-11d : cpus %s, %d worker process(es)\n", nodes[k].id, nodes[k].cpulist,
+                   (NUM_PROCESSES - k + num_nodes - 1) / num_nodes);
+        fflush(stdout);
+    }
+
+    if (numa_mode)
+        print_affinity_nodes(NUM_PROCESSES, NUM_THREADS, nodes, num_nodes);
+    else
+        print_affinity(NUM_PROCESSES, NUM_THREADS);
+
     struct timespec wall_start, wall_end;
     struct rusage usage_self_start, usage_self_end, usage_child_end;
     clock_gettime(CLOCK_MONOTONIC, &wall_start);
     getrusage(RUSAGE_SELF, &usage_self_start);
 
+    fflush(stdout);     // a child would print what is still buffered again at exit()
     pid_t producer_pid = fork();
     if (producer_pid == 0) {
+        affinity_pin_self(0);
         producer(NULL);
         exit(0);
     }
@@ -282,9 +225,18 @@ int main() {
     pid_t workers[NUM_PROCESSES];
     for (int i = 0; i < NUM_PROCESSES; i++) {
         if ((workers[i] = fork()) == 0) {
+            int node = i % num_nodes;
+            // also confines the FC team (fc_team_pin() uses this thread's mask) to the node,
+            // so dense FC1 reads stay on the node's replica
+            if (numa_mode) topo_bind_node(&nodes[node]);
             pthread_t threads[NUM_THREADS];
-            for (int j = 0; j < NUM_THREADS; j++)
-                pthread_create(&threads[j], NULL, consumer, NULL);
+            for (int j = 0; j < NUM_THREADS; j++) {
+                pthread_attr_t attr;
+                pthread_attr_init(&attr);
+                affinity_attr(&attr, 1 + i * NUM_THREADS + j);
+                pthread_create(&threads[j], &attr, consumer, (void*)(intptr_t)node);
+                pthread_attr_destroy(&attr);
+            }
             for (int j = 0; j < NUM_THREADS; j++)
                 pthread_join(threads[j], NULL);
             exit(0);
@@ -314,7 +266,11 @@ int main() {
     printf("User CPU Time      : %.2f ms\n", user_usec / 1000.0);
     printf("System CPU Time    : %.2f ms\n", sys_usec / 1000.0);
     printf("CPU Utilization    : %.2f %%\n", cpu_util);
+    print_perf_counters();
+    printf("Conv Engine        : %s\n", conv_engine_name(conv_engine));
     printf("Total Tasks Done   : %d\n", *task_done_count);
+    print_fc1_traffic(*task_done_count);
+    print_task_stats();
     print_memory_usage();
 
     return 0;
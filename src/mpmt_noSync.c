@@ -10,55 +10,24 @@
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <time.h>
+#include "cnn_common.h"
+#include "task_stats.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "huge_pages.h"
+#include "affinity.h"
+#include "wait_policy.h"
 #define gettid() syscall(SYS_gettid)
 
-#define INPUT_SIZE 224
-#define CHANNELS 3
-#define KERNEL_SIZE 3
-#define CONV_DEPTH 64
-#define CONV_OUT (INPUT_SIZE - KERNEL_SIZE + 1)
-#define FC1_OUT 256
-#define FC2_OUT 100
 #define NUM_INPUTS 40 
 #define NUM_THREADS 4
 #define NUM_PROCESSES 4
 #define QUEUE_SIZE NUM_INPUTS
 
-typedef struct {
-    float conv_out[CONV_OUT][CONV_OUT][CONV_DEPTH];
-    float relu_out[CONV_OUT][CONV_OUT][CONV_DEPTH];
-    float pool_out[CONV_OUT/2][CONV_OUT/2][CONV_DEPTH];
-    float flat[(CONV_OUT/2)*(CONV_OUT/2)*CONV_DEPTH];
-    float fc1_out[FC1_OUT];
-    float fc2_out[FC2_OUT];
-    float input[INPUT_SIZE][INPUT_SIZE][CHANNELS];
-    int input_id;
-} Task;
-
-typedef struct {
-    float weights[CONV_DEPTH][CHANNELS][KERNEL_SIZE][KERNEL_SIZE];
-    float biases[CONV_DEPTH];
-} ConvLayer;
-
-typedef struct {
-    float weights[FC1_OUT][(CONV_OUT / 2)*(CONV_OUT / 2)*CONV_DEPTH];
-    float biases[FC1_OUT];
-} FullyConnectedLayer1;
-
-typedef struct {
-    float weights[FC2_OUT][FC1_OUT];
-    float biases[FC2_OUT];
-} FullyConnectedLayer2;
-
-typedef struct {
-    ConvLayer conv;
-    FullyConnectedLayer1 fc1;
-    FullyConnectedLayer2 fc2;
-} CNNModel;
-
 typedef struct {
     Task* buffer[QUEUE_SIZE];
     int front, rear, count;
+    WaitWord not_empty, not_full;   // only used to sleep while idle, the ring itself stays unsynchronized
 } TaskQueue;
 
 CNNModel* model;
@@ -67,100 +36,61 @@ TaskQueue* queue;
 int* task_done_count;
 _Atomic int* producer_finished;
 
-void initialize_weights(CNNModel* model) {
-    int kernel[3][3] = {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}};
-    for (int d = 0; d < CONV_DEPTH; d++) {
-        model->conv.biases[d] = 1.0f;
-        for (int c = 0; c < CHANNELS; c++)
-            for (int i = 0; i < KERNEL_SIZE; i++)
-                for (int j = 0; j < KERNEL_SIZE; j++)
-                    model->conv.weights[d][c][i][j] = kernel[i][j];
-    }
-    for (int i = 0; i < FC1_OUT; i++) {
-        model->fc1.biases[i] = 1.0f;
-        for (int j = 0; j < (CONV_OUT / 2)*(CONV_OUT / 2)*CONV_DEPTH; j++)
-            model->fc1.weights[i][j] = (i == j) ? 1.0f : 0.0f;
-    }
-    for (int i = 0; i < FC2_OUT; i++) {
-        model->fc2.biases[i] = 1.0f;
-        for (int j = 0; j < FC1_OUT; j++)
-            model->fc2.weights[i][j] = (i == j) ? 1.0f : 0.0f;
-    }
-}
-
-void initialize_input(Task* t, int id) {
-    float center = 9.0f * (id + 1);
-    t->input_id = id;
-    for (int c = 0; c < CHANNELS; c++)
-        for (int i = 0; i < INPUT_SIZE; i++)
-            for (int j = 0; j < INPUT_SIZE; j++)
-                t->input[i][j][c] = (i == 1 && j == 1) ? center : 1.0f;
-}
-
-void conv_relu_pool_fc(Task* t) {
-    for (int d = 0; d < CONV_DEPTH; d++)
-        for (int i = 0; i < CONV_OUT; i++)
-            for (int j = 0; j < CONV_OUT; j++) {
-                float sum = model->conv.biases[d];
-                for (int c = 0; c < CHANNELS; c++)
-                    for (int ki = 0; ki < KERNEL_SIZE; ki++)
-                        for (int kj = 0; kj < KERNEL_SIZE; kj++)
-                            sum += model->conv.weights[d][c][ki][kj] * t->input[i + ki][j + kj][c];
-                t->conv_out[i][j][d] = sum;
-                t->relu_out[i][j][d] = (sum > 0) ? sum : 0;
-            }
-    int idx = 0;
-    for (int d = 0; d < CONV_DEPTH; d++)
-        for (int x = 0; x < CONV_OUT; x += 2)
-            for (int y = 0; y < CONV_OUT; y += 2) {
-                float maxval = t->relu_out[x][y][d];
-                for (int dx = 0; dx < 2; dx++)
-                    for (int dy = 0; dy < 2; dy++)
-                        if (t->relu_out[x + dx][y + dy][d] > maxval)
-                            maxval = t->relu_out[x + dx][y + dy][d];
-                t->pool_out[x/2][y/2][d] = maxval;
-                t->flat[idx++] = maxval;
-            }
-    for (int i = 0; i < FC1_OUT; i++) {
-        float sum = model->fc1.biases[i];
-        for (int j = 0; j < idx; j++) sum += model->fc1.weights[i][j] * t->flat[j];
-        t->fc1_out[i] = sum;
-    }
-    for (int i = 0; i < FC2_OUT; i++) {
-        float sum = model->fc2.biases[i];
-        for (int j = 0; j < FC1_OUT; j++) sum += model->fc2.weights[i][j] * t->fc1_out[j];
-        t->fc2_out[i] = sum;
-    }
-}
-
 void* producer(void* arg) {
     for (int i = 0; i < NUM_INPUTS; i++) {
         Task* t = &task_pool[i];
         initialize_input(t, i);
-        while (queue->count == QUEUE_SIZE);
+        while (queue->count == QUEUE_SIZE) {
+            uint32_t key = wait_prepare(&queue->not_full);
+            if (queue->count < QUEUE_SIZE) break;
+            wait_for(&queue->not_full, key);
+        }
         queue->buffer[queue->rear] = t;
         queue->rear = (queue->rear + 1) % QUEUE_SIZE;
         queue->count++;
+        wake_one(&queue->not_empty);
     }
     atomic_store(producer_finished, 1);
+    wake_all(&queue->not_empty);
     return NULL;
 }
 
 void* consumer(void* arg) {
+    Scratch* scratch = scratch_create();
     while (1) {
-        if (atomic_load(producer_finished) && queue->count == 0)
+        uint32_t key = wait_prepare(&queue->not_empty);
+        if (atomic_load(producer_finished) && queue->count == 0) {
+            scratch_destroy(scratch);
             return NULL;
-        if (queue->count == 0) continue;
-        Task* t = queue->buffer[queue->front];
-        queue->front = (queue->front + 1) % QUEUE_SIZE;
-        queue->count--;
+        }
+        if (queue->count == 0) {
+            wait_for(&queue->not_empty, key);
+            continue;
+        }
+        Task* batch[FC_MAX_BATCH];
+        int n = 0;
+        while (n < fc_batch_size && queue->count > 0) {
+            batch[n++] = queue->buffer[queue->front];
+            queue->front = (queue->front + 1) % QUEUE_SIZE;
+            queue->count--;
+        }
+        wake_one(&queue->not_full);
+
+        if (quiet_mode) {
+            TaskClock clock;
+            task_clock_start(&clock);
+            conv_relu_pool_fc_batch(model, batch, n, scratch);
+            task_stats_record(&clock, batch, n);
+            *task_done_count += n;
+            continue;
+        }
 
         struct timespec start, end;
         struct rusage usage_start, usage_end;
         clock_gettime(CLOCK_MONOTONIC, &start);
         getrusage(RUSAGE_SELF, &usage_start);
 
-        conv_relu_pool_fc(t);
+        conv_relu_pool_fc_batch(model, batch, n, scratch);
 
         clock_gettime(CLOCK_MONOTONIC, &end);
         getrusage(RUSAGE_SELF, &usage_end);
@@ -172,19 +102,26 @@ void* consumer(void* arg) {
         double wall_msec = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
         double cpu_util = 100.0 * (user_usec + sys_usec) / 1000.0 / wall_msec;
 
-        printf("[Consumer %d] Input ID: %d\n", getpid(), t->input_id);
-        printf("Conv Output [0][0][0] = %.2f\n", t->conv_out[0][0][0]);
-        printf("fc1[0:5] = ");
-        for (int j = 0; j < 5; j++) printf("%.2f ", t->fc1_out[j]);
-        printf("\nfc2[0:5] = ");
-        for (int j = 0; j < 5; j++) printf("%.2f ", t->fc2_out[j]);
-        printf("\n== Resource Usage ==\n");
+        for (int b = 0; b < n; b++) {
+            Task* t = batch[b];
+            printf("[Consumer %d] Input ID: %d\n", getpid(), t->input_id);
+            if (scratch->conv_out && n == 1)
+                printf("Conv Output [0][0][0] = %.2f\n", scratch->conv_out[0][0][0]);
+            else
+                printf("Pool Output [0][0][0] = %.2f\n", scratch->flat[b][0]);
+            printf("fc1[0:5] = ");
+            for (int j = 0; j < 5; j++) printf("%.2f ", scratch->fc1_out[b][j]);
+            printf("\nfc2[0:5] = ");
+            for (int j = 0; j < 5; j++) printf("%.2f ", t->fc2_out[j]);
+            printf("\n");
+        }
+        printf("== Resource Usage ==\n");
         printf("User CPU Time   : %.3f ms\n", user_usec / 1000.0);
         printf("System CPU Time : %.3f ms\n", sys_usec / 1000.0);
         printf("CPU Utilization : %.2f %%\n", cpu_util);
         printf("Wall Clock Time : %.3f ms\n\n", wall_msec);
 
-        (*task_done_count)++;
+        *task_done_count += n;
     }
 }
 
@@ -206,8 +143,8 @@ void print_memory_usage() {
 }
 
 int main() {
-    model = mmap(NULL, sizeof(CNNModel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    task_pool = mmap(NULL, sizeof(Task) * NUM_INPUTS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    model = huge_map(sizeof(CNNModel), 1, REGION_MODEL);
+    task_pool = huge_map(sizeof(Task) * NUM_INPUTS, 1, REGION_TASKS);
     queue = mmap(NULL, sizeof(TaskQueue), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     task_done_count = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     producer_finished = mmap(NULL, sizeof(_Atomic int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
@@ -216,13 +153,26 @@ int main() {
     atomic_store(producer_finished, 0);
 
     queue->front = queue->rear = queue->count = 0;
+    wait_word_init(&queue->not_empty);
+    wait_word_init(&queue->not_full);
+    select_wait_policy();
+    select_conv_engine();
+    select_fc_batch();
+    select_task_stats(NUM_INPUTS);
+    select_perf_counters();
+    select_trace();
+    select_affinity();
     initialize_weights(model);
 
+    print_affinity(NUM_PROCESSES, NUM_THREADS);
+
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
 
+    fflush(stdout);     // a child would print what is still buffered again at exit()
     pid_t producer_pid = fork();
     if (producer_pid == 0) {
+        affinity_pin_self(0);
         producer(NULL);
         exit(0);
     }
@@ -231,8 +181,13 @@ int main() {
     for (int i = 0; i < NUM_PROCESSES; i++) {
         if ((workers[i] = fork()) == 0) {
             pthread_t threads[NUM_THREADS];
-            for (int j = 0; j < NUM_THREADS; j++)
-                pthread_create(&threads[j], NULL, consumer, NULL);
+            for (int j = 0; j < NUM_THREADS; j++) {
+                pthread_attr_t attr;
+                pthread_attr_init(&attr);
+                affinity_attr(&attr, 1 + i * NUM_THREADS + j);
+                pthread_create(&threads[j], &attr, consumer, NULL);
+                pthread_attr_destroy(&attr);
+            }
             for (int j = 0; j < NUM_THREADS; j++)
                 pthread_join(threads[j], NULL);
             exit(0);
@@ -261,7 +216,12 @@ int main() {
     printf("User CPU Time      : %.2f ms\n", user_usec / 1000.0);
     printf("System CPU Time    : %.2f ms\n", sys_usec / 1000.0);
     printf("CPU Utilization    : %.2f %%\n", cpu_util);
+    print_perf_counters();
+    printf("Conv Engine        : %s\n", conv_engine_name(conv_engine));
+    printf("Wait Policy        : %s\n", wait_policy_name(wait_policy));
     printf("Total Tasks Done   : %d\n", *task_done_count);
+    print_fc1_traffic(*task_done_count);
+    print_task_stats();
     print_memory_usage();
 
     return 0;
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf_counters.h"
+
+#define HW_CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} events[PERF_EVENT_COUNT] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"LLC misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB misses", PERF_TYPE_HW_CACHE, HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"frontend stalls", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {"backend stalls", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    {"page faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static const char* stage_names[PERF_STAGE_COUNT] = {"conv", "fc1", "fc2"};
+
+typedef struct {
+    int fd[PERF_EVENT_COUNT];
+    PerfSnapshot sum[PERF_STAGE_COUNT];
+    uint64_t inputs[PERF_STAGE_COUNT];
+} PerfThread;
+
+typedef struct {
+    _Atomic uint64_t value[PERF_STAGE_COUNT][PERF_EVENT_COUNT];
+    _Atomic uint64_t enabled[PERF_STAGE_COUNT][PERF_EVENT_COUNT];
+    _Atomic uint64_t running[PERF_STAGE_COUNT][PERF_EVENT_COUNT];
+    _Atomic uint64_t inputs[PERF_STAGE_COUNT];
+    _Atomic int opened[PERF_EVENT_COUNT];    // threads that could open the event
+    _Atomic int open_errno[PERF_EVENT_COUNT];
+    _Atomic int threads;
+} PerfTotals;
+
+int perf_enabled = 0;
+static PerfTotals* totals;
+static pthread_key_t perf_key;
+static __thread PerfThread* perf_local;
+
+// moves the thread's sums into the shared table
+static void perf_fold(PerfThread* t) {
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            atomic_fetch_add(&totals->value[s][e], t->sum[s].value[e]);
+            atomic_fetch_add(&totals->enabled[s][e], t->sum[s].enabled[e]);
+            atomic_fetch_add(&totals->running[s][e], t->sum[s].running[e]);
+        }
+        atomic_fetch_add(&totals->inputs[s], t->inputs[s]);
+    }
+    memset(t->sum, 0, sizeof(t->sum));
+    memset(t->inputs, 0, sizeof(t->inputs));
+}
+
+static void perf_close(PerfThread* t, int fold) {
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        if (t->fd[e] >= 0) close(t->fd[e]);
+    if (fold) perf_fold(t);
+    free(t);
+}
+
+static void thread_exit(void* p) {
+    perf_close(p, 1);
+}
+
+// counts the calling thread on whatever CPU it runs, user space only, so the default
+// perf_event_paranoid setting of 2 is enough
+static PerfThread* perf_thread(void) {
+    PerfThread* t = calloc(1, sizeof(PerfThread));
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[e].type;
+        attr.config = events[e].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        t->fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (t->fd[e] >= 0)
+            atomic_fetch_add(&totals->opened[e], 1);
+        else
+            atomic_store(&totals->open_errno[e], errno);
+    }
+    atomic_fetch_add(&totals->threads, 1);
+    pthread_setspecific(perf_key, t);
+    perf_local = t;
+    return t;
+}
+
+void perf_read(PerfSnapshot* s) {
+    PerfThread* t = perf_local ? perf_local : perf_thread();
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        uint64_t buf[3] = {0, 0, 0};
+        if (t->fd[e] >= 0 && read(t->fd[e], buf, sizeof(buf)) != sizeof(buf))
+            buf[0] = buf[1] = buf[2] = 0;
+        s->value[e] = buf[0];
+        s->enabled[e] = buf[1];
+        s->running[e] = buf[2];
+    }
+}
+
+void perf_account(PerfStage stage, PerfSnapshot* since, int inputs) {
+    PerfSnapshot now;
+    perf_read(&now);
+    PerfSnapshot* sum = &perf_local->sum[stage];
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        sum->value[e] += now.value[e] - since->value[e];
+        sum->enabled[e] += now.enabled[e] - since->enabled[e];
+        sum->running[e] += now.running[e] - since->running[e];
+    }
+    perf_local->inputs[stage] += inputs;
+    *since = now;
+}
+
+// For threads that may be killed by their process's exit() before their destructor runs (the
+// FC team members): folds what they counted so far without closing the counters.
+void perf_flush(void) {
+    if (perf_local) perf_fold(perf_local);
+}
+
+// threads fold through the key destructor; the main thread of a worker process leaves with exit()
+static void fold_at_exit(void) {
+    if (perf_local) {
+        pthread_setspecific(perf_key, NULL);
+        perf_close(perf_local, 1);
+        perf_local = NULL;
+    }
+}
+
+// a forked child must open its own counters: the inherited fds count the parent's thread
+static void after_fork_child(void) {
+    if (perf_local) {
+        pthread_setspecific(perf_key, NULL);
+        perf_close(perf_local, 0);
+        perf_local = NULL;
+    }
+}
+
+// Call before forking.
+void select_perf_counters(void) {
+    const char* perf = getenv("CNN_PERF");
+    perf_enabled = (perf && atoi(perf) != 0);
+    if (!perf_enabled) return;
+
+    totals = mmap(NULL, sizeof(PerfTotals), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (totals == MAP_FAILED) {
+        perror("mmap perf counters");
+        exit(1);
+    }
+    pthread_key_create(&perf_key, thread_exit);
+    pthread_atfork(NULL, NULL, after_fork_child);
+    atexit(fold_at_exit);
+}
+
+static double scaled(int stage, PerfEvent e) {
+    uint64_t running = atomic_load(&totals->running[stage][e]);
+    if (running == 0) return 0.0;
+    return (double)atomic_load(&totals->value[stage][e]) * atomic_load(&totals->enabled[stage][e]) / running;
+}
+
+static void metric(const char** sep, const char* format, double value) {
+    printf("%s", *sep);
+    printf(format, value);
+    *sep = ", ";
+}
+
+// Per stage: cycles and events per input, IPC, and stalled cycles as a share of all cycles.
+void print_perf_counters(void) {
+    if (!perf_enabled) return;
+    fold_at_exit();
+
+    char missing[256] = "";
+    int have[PERF_EVENT_COUNT], err = 0;
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        have[e] = atomic_load(&totals->opened[e]) > 0;
+        if (!have[e] && !err) err = atomic_load(&totals->open_errno[e]);
+        if (!have[e])
+            snprintf(missing + strlen(missing), sizeof(missing) - strlen(missing), "%s%s", missing[0] ? ", " : "",
+                     events[e].name);
+    }
+    printf("Perf Counters      : %d thread(s)", atomic_load(&totals->threads));
+    if (missing[0])
+        printf(", unavailable: %s (%s)", missing, strerror(err));
+    printf("\n");
+
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        uint64_t inputs = atomic_load(&totals->inputs[s]);
+        if (inputs == 0) continue;
+        double cycles = scaled(s, PERF_CYCLES);
+        const char* sep = " ";
+        printf("  %-17s:", stage_names[s]);
+        if (have[PERF_CYCLES])
+            metric(&sep, "%.2f Mcycles/input", cycles / inputs / 1e6);
+        if (have[PERF_CYCLES] && have[PERF_INSTRUCTIONS] && cycles > 0)
+            metric(&sep, "IPC %.2f", scaled(s, PERF_INSTRUCTIONS) / cycles);
+        if (have[PERF_LLC_MISSES])
+            metric(&sep, "LLC miss %.0f/input", scaled(s, PERF_LLC_MISSES) / inputs);
+        if (have[PERF_DTLB_MISSES])
+            metric(&sep, "dTLB miss %.0f/input", scaled(s, PERF_DTLB_MISSES) / inputs);
+        if (have[PERF_BRANCH_MISSES])
+            metric(&sep, "branch miss %.0f/input", scaled(s, PERF_BRANCH_MISSES) / inputs);
+        if (have[PERF_STALLED_FRONTEND] && cycles > 0)
+            metric(&sep, "FE stall %.1f %%", 100.0 * scaled(s, PERF_STALLED_FRONTEND) / cycles);
+        if (have[PERF_STALLED_BACKEND] && cycles > 0)
+            metric(&sep, "BE stall %.1f %%", 100.0 * scaled(s, PERF_STALLED_BACKEND) / cycles);
+        if (have[PERF_PAGE_FAULTS])
+            metric(&sep, "page faults %.1f/input", scaled(s, PERF_PAGE_FAULTS) / inputs);
+        printf("\n");
+    }
+}
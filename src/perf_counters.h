@@ -0,0 +1,55 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+// Hardware counters per consumer thread (CNN_PERF=1), opened with perf_event_open on the
+// first batch a thread runs and read at the layer boundaries of conv_relu_pool_fc_batch():
+// the fused conv/ReLU/pool/flatten pass, FC1 and FC2. FC team threads (CNN_FC_THREADS > 1)
+// count their own row ranges into the FC stage of the job; inputs are counted by the caller. Per-thread sums are folded into a
+// MAP_SHARED table when the thread or its process exits, so forked workers count too.
+// Events the kernel or PMU does not offer (e.g. in most VMs) are reported as unavailable;
+// multiplexed events are scaled by time_enabled / time_running.
+typedef enum {
+    PERF_STAGE_CONV,
+    PERF_STAGE_FC1,
+    PERF_STAGE_FC2,
+    PERF_STAGE_COUNT
+} PerfStage;
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_STALLED_FRONTEND,
+    PERF_STALLED_BACKEND,
+    PERF_PAGE_FAULTS,
+    PERF_EVENT_COUNT
+} PerfEvent;
+
+typedef struct {
+    uint64_t value[PERF_EVENT_COUNT];
+    uint64_t enabled[PERF_EVENT_COUNT];
+    uint64_t running[PERF_EVENT_COUNT];
+} PerfSnapshot;
+
+extern int perf_enabled;
+
+void select_perf_counters(void);
+void perf_read(PerfSnapshot* s);
+void perf_account(PerfStage stage, PerfSnapshot* since, int inputs);
+void perf_flush(void);
+void print_perf_counters(void);
+
+static inline void perf_start(PerfSnapshot* s) {
+    if (perf_enabled) perf_read(s);
+}
+
+// adds the counts since *since to stage and restarts *since from now
+static inline void perf_stage(PerfStage stage, PerfSnapshot* since, int inputs) {
+    if (perf_enabled) perf_account(stage, since, inputs);
+}
+
+#endif // PERF_COUNTERS_H
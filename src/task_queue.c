@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "task_queue.h"
+#include "trace.h"
+
+static size_t tq_bytes(int capacity) {
+    return sizeof(TaskQueue) + sizeof(Task*) * capacity;
+}
+
+TaskQueue* tq_create(int capacity) {
+    TaskQueue* q = mmap(NULL, tq_bytes(capacity), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (q == MAP_FAILED) {
+        perror("mmap queue");
+        exit(1);
+    }
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&q->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&q->not_empty, &cattr);
+    pthread_cond_init(&q->not_full, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    q->front = q->rear = q->count = 0;
+    q->capacity = capacity;
+    q->closed = 0;
+    return q;
+}
+
+void tq_destroy(TaskQueue* q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    munmap(q, tq_bytes(q->capacity));
+}
+
+void tq_close(TaskQueue* q) {
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// Moves all n tasks, waiting for room only when the ring is full. Each critical section moves
+// as many tasks as fit and ends with a single wakeup: signal for one task, broadcast for more,
+// since several consumers may each take part of it.
+void enqueue_batch(TaskQueue* q, Task* const tasks[], int n) {
+    long long start = trace_begin();
+    int done = 0;
+    pthread_mutex_lock(&q->mutex);
+    trace_end(TRACE_LOCK_WAIT, start, 0);
+    while (done < n) {
+        long long idle = trace_begin();
+        while (q->count == q->capacity)
+            pthread_cond_wait(&q->not_full, &q->mutex);
+        trace_end(TRACE_IDLE, idle, 0);
+        int moved = 0;
+        while (done < n && q->count < q->capacity) {
+            q->buffer[q->rear] = tasks[done++];
+            q->rear = (q->rear + 1) % q->capacity;
+            q->count++;
+            moved++;
+        }
+        if (moved == 1)
+            pthread_cond_signal(&q->not_empty);
+        else
+            pthread_cond_broadcast(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    trace_end(TRACE_ENQUEUE, start, n);
+}
+
+// Blocks until at least one task is available and takes up to max of them in one critical
+// section. Returns 0 once the queue is closed and empty.
+int dequeue_batch(TaskQueue* q, Task* out[], int max) {
+    long long start = trace_begin();
+    pthread_mutex_lock(&q->mutex);
+    trace_end(TRACE_LOCK_WAIT, start, 0);
+    long long idle = trace_begin();
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    trace_end(TRACE_IDLE, idle, 0);
+    int n = 0;
+    while (n < max && q->count > 0) {
+        out[n++] = q->buffer[q->front];
+        q->front = (q->front + 1) % q->capacity;
+        q->count--;
+    }
+    if (n == 1)
+        pthread_cond_signal(&q->not_full);
+    else if (n > 1)
+        pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    trace_end(TRACE_DEQUEUE, start, n);
+    return n;
+}
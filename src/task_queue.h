@@ -0,0 +1,25 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <pthread.h>
+#include "cnn_common.h"
+
+// Bounded Task* ring guarded by one mutex and two condition variables. The queue is created
+// in a MAP_SHARED mapping with PTHREAD_PROCESS_SHARED attributes, so the same code serves
+// threads of one process and forked processes.
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty, not_full;
+    int front, rear, count;
+    int capacity;
+    int closed;        // set by tq_close(), consumers drain what is left and then stop
+    Task* buffer[];
+} TaskQueue;
+
+TaskQueue* tq_create(int capacity);
+void tq_destroy(TaskQueue* q);
+void tq_close(TaskQueue* q);
+void enqueue_batch(TaskQueue* q, Task* const tasks[], int n);
+int dequeue_batch(TaskQueue* q, Task* out[], int max);
+
+#endif // TASK_QUEUE_H
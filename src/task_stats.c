@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "task_stats.h"
+
+typedef struct {
+    _Atomic long next;      // total records written; slot is next % capacity
+    long capacity;
+    TaskRecord records[];
+} TaskRing;
+
+int quiet_mode = 0;
+static TaskRing* ring;
+
+static long long ts_ns(struct timespec t) {
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// Call before forking, with the number of inputs the run will process.
+void select_task_stats(int capacity) {
+    const char* quiet = getenv("CNN_QUIET");
+    quiet_mode = (quiet && atoi(quiet) != 0);
+    if (!quiet_mode) return;
+
+    if (capacity < 1) capacity = 1;
+    ring = mmap(NULL, sizeof(TaskRing) + sizeof(TaskRecord) * capacity, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap task ring");
+        exit(1);
+    }
+    atomic_init(&ring->next, 0);
+    ring->capacity = capacity;
+}
+
+void task_clock_start(TaskClock* c) {
+    clock_gettime(CLOCK_MONOTONIC, &c->wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c->cpu);
+}
+
+// one fetch_add per batch reserves n consecutive slots, so workers never share a lock
+void task_stats_record(const TaskClock* c, Task* const batch[], int n) {
+    struct timespec wall, cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    if (!ring) return;
+
+    int worker = (int)syscall(SYS_gettid);
+    long long cpu_ns = (ts_ns(cpu) - ts_ns(c->cpu)) / n;
+    long first = atomic_fetch_add(&ring->next, n);
+    for (int b = 0; b < n; b++) {
+        TaskRecord* r = &ring->records[(first + b) % ring->capacity];
+        r->input_id = batch[b]->input_id;
+        r->worker = worker;
+        r->batch = n;
+        r->start_ns = ts_ns(c->wall);
+        r->end_ns = ts_ns(wall);
+        r->cpu_ns = cpu_ns;
+    }
+}
+
+static int cmp_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+static void write_task_log(const TaskRecord* records, long count, long long origin) {
+    const char* path = getenv("CNN_TASK_LOG");
+    if (!path) return;
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror("fopen CNN_TASK_LOG");
+        return;
+    }
+    fprintf(f, "input_id,worker,batch,start_us,end_us,cpu_us\n");
+    for (long i = 0; i < count; i++)
+        fprintf(f, "%d,%d,%d,%.1f,%.1f,%.1f\n", records[i].input_id, records[i].worker, records[i].batch,
+                (records[i].start_ns - origin) / 1e3, (records[i].end_ns - origin) / 1e3, records[i].cpu_ns / 1e3);
+    fclose(f);
+    printf("Task Log           : %s\n", path);
+}
+
+void print_task_stats(void) {
+    if (!ring) return;
+    long total = atomic_load(&ring->next);
+    long count = (total < ring->capacity) ? total : ring->capacity;
+    printf("== Task Stats (CNN_QUIET) ==\n");
+    printf("Tasks Recorded     : %ld of %ld (ring %ld)\n", count, total, ring->capacity);
+    if (count == 0) return;
+
+    const TaskRecord* r = ring->records;
+    long long* latency = malloc(sizeof(long long) * count);
+    long long* workers = malloc(sizeof(long long) * count);
+    long long first = r[0].start_ns, last = r[0].end_ns, cpu = 0;
+    for (long i = 0; i < count; i++) {
+        latency[i] = r[i].end_ns - r[i].start_ns;
+        workers[i] = r[i].worker;
+        cpu += r[i].cpu_ns;
+        if (r[i].start_ns < first) first = r[i].start_ns;
+        if (r[i].end_ns > last) last = r[i].end_ns;
+    }
+    qsort(latency, count, sizeof(long long), cmp_ll);
+    qsort(workers, count, sizeof(long long), cmp_ll);
+
+    // tasks per worker, from the runs of equal ids in the sorted worker list
+    int nworkers = 0;
+    long min_tasks = count, max_tasks = 0;
+    for (long i = 0, j; i < count; i = j) {
+        for (j = i; j < count && workers[j] == workers[i]; j++) {}
+        nworkers++;
+        if (j - i < min_tasks) min_tasks = j - i;
+        if (j - i > max_tasks) max_tasks = j - i;
+    }
+
+    double span_ms = (last - first) / 1e6;
+    printf("Workers            : %d, %ld-%ld task(s) each\n", nworkers, min_tasks, max_tasks);
+    printf("Batch Latency      : median %.2f ms, p95 %.2f ms, max %.2f ms\n", latency[count / 2] / 1e6,
+           latency[(count * 95 + 99) / 100 - 1] / 1e6, latency[count - 1] / 1e6);
+    printf("Thread CPU Time    : %.2f ms (%.2f ms per task)\n", cpu / 1e6, cpu / 1e6 / count);
+    printf("Processing Span    : %.2f ms (%.1f inputs/s)\n", span_ms, span_ms > 0 ? count / (span_ms / 1e3) : 0.0);
+    write_task_log(r, count, first);
+    free(latency);
+    free(workers);
+}
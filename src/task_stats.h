@@ -0,0 +1,32 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <time.h>
+#include "cnn_common.h"
+
+// Quiet mode (CNN_QUIET=1): consumers skip the per-batch getrusage and the printing under the
+// shared print mutex, and instead append one record per task to a preallocated MAP_SHARED
+// ring, which the main process summarizes once at the end (and dumps to CNN_TASK_LOG as
+// CSV if set). When more tasks run than the ring holds, the oldest records are overwritten.
+typedef struct {
+    int input_id;
+    int worker;             // kernel thread id, unique across the forked processes
+    int batch;              // tasks processed in the same conv_relu_pool_fc_batch call
+    long long start_ns;     // CLOCK_MONOTONIC around the batch
+    long long end_ns;
+    long long cpu_ns;       // CLOCK_THREAD_CPUTIME_ID spent on the batch, split evenly
+} TaskRecord;
+
+typedef struct {
+    struct timespec wall;
+    struct timespec cpu;
+} TaskClock;
+
+extern int quiet_mode;
+
+void select_task_stats(int capacity);
+void task_clock_start(TaskClock* c);
+void task_stats_record(const TaskClock* c, Task* const batch[], int n);
+void print_task_stats(void);
+
+#endif // TASK_STATS_H
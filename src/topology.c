@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "topology.h"
+
+#define TOPO_MASK_BITS 1024
+
+// "0-3,8,10-11" -> set; returns the number of CPUs
+int topo_parse_cpulist(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) break;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) CPU_SET(c, set);
+        p = (*end == ',') ? end + 1 : end;
+        if (*p == '\n') break;
+    }
+    return CPU_COUNT(set);
+}
+
+static int read_line(const char* path, char* buf, size_t size) {
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    int ok = fgets(buf, size, f) != NULL;
+    fclose(f);
+    if (ok) buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+static int read_int(const char* fmt, int cpu, int fallback) {
+    char path[128], buf[64];
+    snprintf(path, sizeof(path), fmt, cpu);
+    return read_line(path, buf, sizeof(buf)) ? atoi(buf) : fallback;
+}
+
+// Online CPUs in ascending order. Missing sysfs entries degrade to one core per CPU.
+int topo_cpus(CpuInfo cpus[], int max) {
+    char online[256], path[128], list[256];
+    cpu_set_t set;
+    if (read_line("/sys/devices/system/cpu/online", online, sizeof(online)))
+        topo_parse_cpulist(online, &set);
+    else
+        sched_getaffinity(0, sizeof(set), &set);
+
+    int count = 0;
+    for (int c = 0; c < CPU_SETSIZE && count < max; c++) {
+        if (!CPU_ISSET(c, &set)) continue;
+        CpuInfo* info = &cpus[count++];
+        info->cpu = c;
+        info->package = read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c, 0);
+        info->core = read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", c, c);
+        info->l3 = read_int("/sys/devices/system/cpu/cpu%d/cache/index3/id", c, info->package);
+        info->smt = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+        if (read_line(path, list, sizeof(list))) {
+            cpu_set_t siblings;
+            topo_parse_cpulist(list, &siblings);
+            for (int s = 0; s < c; s++) info->smt += CPU_ISSET(s, &siblings) != 0;
+        }
+    }
+    return count;
+}
+
+int topo_numa_nodes(NumaNode nodes[], int max) {
+    char online[256], path[128];
+    cpu_set_t ids;
+    int count = 0;
+    if (read_line("/sys/devices/system/node/online", online, sizeof(online)))
+        topo_parse_cpulist(online, &ids);
+    else
+        CPU_ZERO(&ids);
+
+    for (int id = 0; id < CPU_SETSIZE && count < max; id++) {
+        if (!CPU_ISSET(id, &ids)) continue;
+        NumaNode* n = &nodes[count];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        if (!read_line(path, n->cpulist, sizeof(n->cpulist))) continue;
+        n->id = id;
+        n->ncpus = topo_parse_cpulist(n->cpulist, &n->cpus);
+        if (n->ncpus > 0) count++;      // memory-only nodes get no workers
+    }
+
+    if (count == 0) {
+        NumaNode* n = &nodes[0];
+        n->id = 0;
+        sched_getaffinity(0, sizeof(n->cpus), &n->cpus);
+        n->ncpus = CPU_COUNT(&n->cpus);
+        snprintf(n->cpulist, sizeof(n->cpulist), "all (%d)", n->ncpus);
+        count = 1;
+    }
+    return count;
+}
+
+// Pins the calling process to the node's CPUs and restricts its future allocations to the
+// node's memory. Threads created afterwards inherit both.
+void topo_bind_node(const NumaNode* node) {
+    unsigned long mask[TOPO_MASK_BITS / 64] = {0};
+    mask[node->id / 64] |= 1UL << (node->id % 64);
+    sched_setaffinity(0, sizeof(node->cpus), &node->cpus);
+    syscall(SYS_set_mempolicy, MPOL_BIND, mask, TOPO_MASK_BITS);
+}
+
+// Places pages of [p, p + len) that are not yet faulted in on the given node; must be called
+// before the first touch. A hugetlb mapping only accepts whole huge pages, so like
+// huge_unmap() the length is retried rounded up to 2 MB and 1 GB.
+void topo_bind_memory(void* p, size_t len, int node) {
+    unsigned long mask[TOPO_MASK_BITS / 64] = {0};
+    mask[node / 64] |= 1UL << (node % 64);
+    size_t pages[3] = {4096, 2UL << 20, 1UL << 30};
+    for (int i = 0; i < 3; i++) {
+        size_t rounded = (len + pages[i] - 1) & ~(pages[i] - 1);
+        if (syscall(SYS_mbind, p, rounded, MPOL_BIND, mask, TOPO_MASK_BITS, 0) == 0) return;
+    }
+}
+
+// Interleaves the calling thread's future page allocations over the online nodes (including
+// memory-only ones). Anonymous shared mappings and page-cache pages follow the policy of the
+// thread that faults them in.
+void topo_interleave_memory(void) {
+    unsigned long mask[TOPO_MASK_BITS / 64] = {0};
+    char online[256];
+    cpu_set_t ids;
+    if (!read_line("/sys/devices/system/node/online", online, sizeof(online))) return;
+    topo_parse_cpulist(online, &ids);
+    for (int id = 0; id < TOPO_MASK_BITS; id++)
+        if (CPU_ISSET(id, &ids)) mask[id / 64] |= 1UL << (id % 64);
+    syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask, TOPO_MASK_BITS);
+}
@@ -0,0 +1,34 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h>
+#include <stddef.h>
+
+#define TOPO_MAX_NODES 16
+
+// NUMA nodes as listed under /sys/devices/system/node. Hosts without that directory (or with
+// NUMA disabled) report a single node 0 holding every online CPU.
+typedef struct {
+    int id;
+    int ncpus;
+    cpu_set_t cpus;
+    char cpulist[128];      // as printed by the kernel, e.g. "0-23,48-71"
+} NumaNode;
+
+// One online CPU as described by /sys/devices/system/cpu/cpuN/{topology,cache/index3}.
+typedef struct {
+    int cpu;
+    int package;
+    int core;           // core_id, unique within a package
+    int l3;             // id of the L3 (CCX on AMD) it shares, the package when unknown
+    int smt;            // position among its core's hardware threads, 0 for the first
+} CpuInfo;
+
+int topo_parse_cpulist(const char* list, cpu_set_t* set);
+int topo_cpus(CpuInfo cpus[], int max);
+int topo_numa_nodes(NumaNode nodes[], int max);
+void topo_bind_node(const NumaNode* node);
+void topo_bind_memory(void* p, size_t len, int node);
+void topo_interleave_memory(void);
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+#define TRACE_MIN_WAIT_NS 1000
+
+typedef struct {
+    int kind;
+    int pid;
+    int tid;
+    int arg;
+    long long start_ns;
+    long long dur_ns;
+} TraceEvent;
+
+typedef struct {
+    _Atomic long next;
+    _Atomic long dropped;
+    long capacity;
+    long long origin_ns;
+    TraceEvent events[];
+} TraceBuffer;
+
+static const struct {
+    const char* name;
+    const char* cat;
+    const char* arg;
+} kinds[TRACE_KIND_COUNT] = {
+    {"input", "producer", "id"},
+    {"enqueue", "queue", "tasks"},
+    {"dequeue", "queue", "tasks"},
+    {"lock wait", "sync", NULL},
+    {"idle", "sync", NULL},
+    {"conv", "layer", "id"},
+    {"fc1", "layer", "batch"},
+    {"fc2", "layer", "batch"},
+};
+
+int trace_enabled = 0;
+static TraceBuffer* trace;
+static const char* trace_path;
+static pid_t owner;
+static __thread int cached_pid, cached_tid;
+
+// the forking thread keeps its cached ids in the child, where both have changed
+static void after_fork_child(void) {
+    cached_pid = cached_tid = 0;
+}
+
+void trace_record(TraceKind kind, long long start_ns, int arg) {
+    long long dur = trace_clock() - start_ns;
+    if ((kind == TRACE_LOCK_WAIT || kind == TRACE_IDLE) && dur < TRACE_MIN_WAIT_NS) return;
+    long slot = atomic_fetch_add(&trace->next, 1);
+    if (slot >= trace->capacity) {
+        atomic_fetch_add(&trace->dropped, 1);
+        return;
+    }
+    if (!cached_tid) {
+        cached_pid = getpid();
+        cached_tid = (int)syscall(SYS_gettid);
+    }
+    TraceEvent* e = &trace->events[slot];
+    e->kind = kind;
+    e->pid = cached_pid;
+    e->tid = cached_tid;
+    e->arg = arg;
+    e->start_ns = start_ns;
+    e->dur_ns = dur;
+}
+
+static void write_trace(void) {
+    if (getpid() != owner) return;
+    FILE* f = fopen(trace_path, "w");
+    if (!f) {
+        perror("fopen CNN_TRACE");
+        return;
+    }
+    long count = atomic_load(&trace->next);
+    if (count > trace->capacity) count = trace->capacity;
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"main %d\"}}", owner,
+            owner);
+    for (long i = 0; i < count; i++) {
+        const TraceEvent* e = &trace->events[i];
+        if (e->tid == 0) continue;      // slot claimed by a process that exited before filling it
+        fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, "
+                "\"ts\": %.3f, \"dur\": %.3f", kinds[e->kind].name, kinds[e->kind].cat, e->pid, e->tid,
+                (e->start_ns - trace->origin_ns) / 1e3, e->dur_ns / 1e3);
+        if (kinds[e->kind].arg)
+            fprintf(f, ", \"args\": {\"%s\": %d}", kinds[e->kind].arg, e->arg);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("Trace File         : %s (%ld events, %ld dropped)\n", trace_path, count, atomic_load(&trace->dropped));
+    fflush(stdout);
+}
+
+// Call before forking.
+void select_trace(void) {
+    trace_path = getenv("CNN_TRACE");
+    trace_enabled = (trace_path && trace_path[0]);
+    if (!trace_enabled) return;
+
+    const char* size = getenv("CNN_TRACE_EVENTS");
+    long capacity = size ? atol(size) : 262144;
+    if (capacity < 1) capacity = 1;
+    trace = mmap(NULL, sizeof(TraceBuffer) + sizeof(TraceEvent) * capacity, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (trace == MAP_FAILED) {
+        perror("mmap trace buffer");
+        exit(1);
+    }
+    trace->capacity = capacity;
+    trace->origin_ns = trace_clock();
+    owner = getpid();
+    pthread_atfork(NULL, NULL, after_fork_child);
+    atexit(write_trace);
+}
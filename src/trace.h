@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+
+// Timeline tracer (CNN_TRACE=path): intervals from every thread of every forked process go
+// into one preallocated MAP_SHARED buffer, and the process that called select_trace() writes
+// them as Chrome Trace Event JSON at exit (open in chrome://tracing or ui.perfetto.dev).
+// CNN_TRACE_EVENTS sets the buffer size (default 262144); events past it are counted as
+// dropped. Lock waits and idle waits shorter than 1 us are not recorded.
+typedef enum {
+    TRACE_INPUT,        // producer filling one input, arg = input id
+    TRACE_ENQUEUE,      // one enqueue_batch call, arg = tasks
+    TRACE_DEQUEUE,      // one dequeue_batch call, arg = tasks taken
+    TRACE_LOCK_WAIT,    // acquiring a queue mutex
+    TRACE_IDLE,         // sleeping on a condition variable or WaitWord
+    TRACE_CONV,         // fused conv/ReLU/pool/flatten of one input, arg = input id
+    TRACE_FC1,          // arg = batch size
+    TRACE_FC2,
+    TRACE_KIND_COUNT
+} TraceKind;
+
+extern int trace_enabled;
+
+void select_trace(void);
+void trace_record(TraceKind kind, long long start_ns, int arg);
+
+static inline long long trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline long long trace_begin(void) {
+    return trace_enabled ? trace_clock() : 0;
+}
+
+// records the interval from start (a trace_begin() value) to now
+static inline void trace_end(TraceKind kind, long long start, int arg) {
+    if (trace_enabled) trace_record(kind, start, arg);
+}
+
+#endif // TRACE_H
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "wait_policy.h"
+#include "trace.h"
+
+// pause iterations and yields before a hybrid waiter goes to sleep
+#define WAIT_SPIN_ROUNDS 4000
+#define WAIT_YIELD_ROUNDS 16
+
+WaitPolicy wait_policy = WAIT_HYBRID;
+
+void select_wait_policy(void) {
+    const char* name = getenv("CNN_WAIT");
+    if (name && strcmp(name, "spin") == 0)
+        wait_policy = WAIT_SPIN;
+    else if (name && strcmp(name, "yield") == 0)
+        wait_policy = WAIT_YIELD;
+    else if (name && strcmp(name, "futex") == 0)
+        wait_policy = WAIT_FUTEX;
+    else
+        wait_policy = WAIT_HYBRID;
+}
+
+const char* wait_policy_name(WaitPolicy policy) {
+    switch (policy) {
+    case WAIT_SPIN: return "spin";
+    case WAIT_YIELD: return "yield";
+    case WAIT_FUTEX: return "futex";
+    case WAIT_HYBRID: return "hybrid";
+    }
+    return "unknown";
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static long futex(_Atomic uint32_t* addr, int op, uint32_t val) {
+    return syscall(SYS_futex, (uint32_t*)addr, op, val, NULL, NULL, 0);
+}
+
+void wait_word_init(WaitWord* w) {
+    atomic_init(&w->seq, 0);
+    atomic_init(&w->waiters, 0);
+}
+
+uint32_t wait_prepare(WaitWord* w) {
+    return atomic_load(&w->seq);
+}
+
+static void wait_changed(WaitWord* w, uint32_t key) {
+    if (wait_policy == WAIT_SPIN) {
+        while (atomic_load_explicit(&w->seq, memory_order_acquire) == key)
+            cpu_relax();
+        return;
+    }
+    if (wait_policy == WAIT_YIELD) {
+        while (atomic_load_explicit(&w->seq, memory_order_acquire) == key)
+            sched_yield();
+        return;
+    }
+    if (wait_policy == WAIT_HYBRID) {
+        for (int i = 0; i < WAIT_SPIN_ROUNDS; i++) {
+            if (atomic_load_explicit(&w->seq, memory_order_acquire) != key) return;
+            cpu_relax();
+        }
+        for (int i = 0; i < WAIT_YIELD_ROUNDS; i++) {
+            if (atomic_load_explicit(&w->seq, memory_order_acquire) != key) return;
+            sched_yield();
+        }
+    }
+
+    // waiters is raised before the kernel compares seq to key, and notifiers bump seq before
+    // reading waiters (both seq_cst), so either the notifier sees us or the kernel sees the new seq
+    atomic_fetch_add(&w->waiters, 1);
+    futex(&w->seq, FUTEX_WAIT, key);
+    atomic_fetch_sub(&w->waiters, 1);
+}
+
+// Returns once seq differs from key (or on a spurious futex wakeup); callers re-check their
+// condition in a loop, so an early return only costs one more pass.
+void wait_for(WaitWord* w, uint32_t key) {
+    long long start = trace_begin();
+    wait_changed(w, key);
+    trace_end(TRACE_IDLE, start, 0);
+}
+
+void wake_one(WaitWord* w) {
+    atomic_fetch_add(&w->seq, 1);
+    if (atomic_load(&w->waiters) > 0)
+        futex(&w->seq, FUTEX_WAKE, 1);
+}
+
+void wake_all(WaitWord* w) {
+    atomic_fetch_add(&w->seq, 1);
+    if (atomic_load(&w->waiters) > 0)
+        futex(&w->seq, FUTEX_WAKE, INT_MAX);
+}
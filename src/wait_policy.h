@@ -0,0 +1,35 @@
+#ifndef WAIT_POLICY_H
+#define WAIT_POLICY_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Event counter for idle producers/consumers. A waiter snapshots seq with wait_prepare(),
+// re-checks its condition, and only then calls wait_for(); a notifier changes the state
+// first and then bumps seq in wake_one()/wake_all(). The futex key is the seq word itself
+// (not FUTEX_PRIVATE), so waiters and notifiers may be in different processes as long as the
+// WaitWord lives in a MAP_SHARED mapping.
+typedef struct {
+    _Atomic uint32_t seq;
+    _Atomic uint32_t waiters;   // threads inside futex wait, lets notifiers skip the syscall
+} WaitWord;
+
+typedef enum {
+    WAIT_SPIN,     // pause loop only
+    WAIT_YIELD,    // sched_yield() loop
+    WAIT_FUTEX,    // sleep in the kernel right away
+    WAIT_HYBRID    // bounded pause spin, then yield, then futex
+} WaitPolicy;
+
+extern WaitPolicy wait_policy;
+
+void select_wait_policy(void);
+const char* wait_policy_name(WaitPolicy policy);
+
+void wait_word_init(WaitWord* w);
+uint32_t wait_prepare(WaitWord* w);
+void wait_for(WaitWord* w, uint32_t key);
+void wake_one(WaitWord* w);
+void wake_all(WaitWord* w);
+
+#endif // WAIT_POLICY_H
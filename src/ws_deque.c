@@ -0,0 +1,63 @@
+#include "ws_deque.h"
+
+_Static_assert((WS_DEQUE_CAP & (WS_DEQUE_CAP - 1)) == 0, "WS_DEQUE_CAP must be a power of two");
+
+void ws_init(WSDeque* d) {
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    for (int i = 0; i < WS_DEQUE_CAP; i++)
+        atomic_init(&d->buffer[i], NULL);
+}
+
+// owner only; returns 0 when the deque is full
+int ws_push(WSDeque* d, Task* t) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= WS_DEQUE_CAP) return 0;
+    atomic_store_explicit(&d->buffer[b & (WS_DEQUE_CAP - 1)], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+// owner only; the last element is settled against thieves with a CAS on top
+WSResult ws_pop(WSDeque* d, Task** t) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return WS_EMPTY;
+    }
+    *t = atomic_load_explicit(&d->buffer[b & (WS_DEQUE_CAP - 1)], memory_order_relaxed);
+    if (top < b) return WS_TASK;
+
+    WSResult r = WS_TASK;
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        r = WS_EMPTY;
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return r;
+}
+
+WSResult ws_steal(WSDeque* d, Task** t) {
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= b) return WS_EMPTY;
+
+    *t = atomic_load_explicit(&d->buffer[top & (WS_DEQUE_CAP - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return WS_ABORT;
+    return WS_TASK;
+}
+
+// owner only; thieves may shrink it at any time, so this is an upper bound
+long ws_size(WSDeque* d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    return b > top ? b - top : 0;
+}
@@ -0,0 +1,31 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <stdatomic.h>
+#include "cnn_common.h"
+#include "lockfree_queue.h"
+
+// fixed capacity: the deque lives in a shared mapping made before fork(), so it cannot grow
+#define WS_DEQUE_CAP 256
+
+// Chase-Lev work-stealing deque (C11 formulation of Le et al., PPoPP'13). Only the owning
+// worker pushes and pops at the bottom; any thread of any process may steal from the top.
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic long top;
+    _Alignas(CACHE_LINE) _Atomic long bottom;
+    _Alignas(CACHE_LINE) Task* _Atomic buffer[WS_DEQUE_CAP];
+} WSDeque;
+
+typedef enum {
+    WS_EMPTY,
+    WS_TASK,
+    WS_ABORT    // lost a race with another thief or the owner, worth retrying
+} WSResult;
+
+void ws_init(WSDeque* d);
+int ws_push(WSDeque* d, Task* t);
+WSResult ws_pop(WSDeque* d, Task** t);
+WSResult ws_steal(WSDeque* d, Task** t);
+long ws_size(WSDeque* d);
+
+#endif // WS_DEQUE_H